@@ -0,0 +1,432 @@
+#include "ans.h"
+#include "io.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Store the 64-bit accumulator at out, and load 32 bits from in, lowest
+// bits in the first byte, as bulk.c does.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define STORE_WORD(out, acc) memcpy((out), &(acc), 8)
+static inline uint32_t load_word(const uint8_t *in) {
+    uint32_t word;
+
+    memcpy(&word, in, 4);
+    return word;
+}
+#else
+#define STORE_WORD(out, acc) store_le((out), (acc), 8)
+static inline uint32_t load_word(const uint8_t *in) {
+    return (uint32_t) load_le(in, 4);
+}
+#endif
+
+// Index of the highest set bit of x, which must not be 0.
+//
+// Input parameters:
+// x: uint32_t: Value to look at
+// Returns: uint32_t: Index of its highest set bit
+static inline uint32_t high_bit(uint32_t x) {
+    return 31 - (uint32_t) __builtin_clz(x);
+}
+
+// Read n bits of buf, starting at bit pos, lowest bit of each byte first.
+// buf must have 3 readable bytes past the byte that pos is in.
+//
+// Input parameters:
+// buf: const uint8_t *: Bits to read
+// pos: int64_t: Bit to start at
+// n: uint32_t: Number of bits, at most 24
+// Returns: uint32_t: The bits
+static inline uint32_t read_bits(const uint8_t *buf, int64_t pos, uint32_t n) {
+    return (load_word(buf + (pos >> 3)) >> (pos & 7)) & ((1u << n) - 1);
+}
+
+// Normalize a histogram to a number of states, so that every symbol that
+// occurs gets at least one. Counts are rounded to the nearest first. What
+// is left over, or handed out over, usually goes to the most common
+// symbol, where it makes the least difference. When that would change it
+// by more than a quarter, the states go one at a time to the symbols
+// where they save the most bits, or are taken back from those where they
+// cost the least.
+//
+// Input parameters:
+// counts: uint16_t *: Filled in with the normalized counts
+// hist: const uint64_t *: Histogram of the block
+// total: uint64_t: Number of symbols in the block, which must not be 0
+// Returns: uint32_t: log2 of the number of states the counts add up to
+uint32_t ans_normalize(uint16_t counts[static ALPHABET], const uint64_t hist[static ALPHABET], uint64_t total) {
+    uint32_t log = total < ANS_SMALL ? ANS_MIN_LOG : ANS_MAX_LOG;
+    int32_t states = 1 << log, left = states;
+    uint32_t largest = 0;
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        counts[s] = 0;
+        if (hist[s] != 0) {
+            counts[s] = (uint16_t) llround((double) hist[s] * states / (double) total);
+            counts[s] += counts[s] == 0;
+            left -= counts[s];
+            largest = hist[s] > hist[largest] ? s : largest;
+        }
+    }
+    if (4 * abs(left) < counts[largest]) {
+        counts[largest] += left;
+        return log;
+    }
+
+    while (left != 0) {
+        double best_gain = -INFINITY;
+        uint32_t best = 0;
+
+        for (uint32_t s = 0; s < ALPHABET; s++) {
+            double gain;
+
+            if (hist[s] == 0 || (left < 0 && counts[s] == 1)) {
+                continue;
+            }
+            if (left > 0) {
+                gain = hist[s] * log2((counts[s] + 1.0) / counts[s]);
+            } else {
+                gain = -(hist[s] * log2(counts[s] / (counts[s] - 1.0)));
+            }
+            if (gain > best_gain) {
+                best_gain = gain;
+                best = s;
+            }
+        }
+        counts[best] += left > 0 ? 1 : -1;
+        left += left > 0 ? -1 : 1;
+    }
+    return log;
+}
+
+// Work out about how many bytes a block codes to with a normalized
+// table: the information its counts give each symbol, and the size and
+// final state of each chunk. The states each chunk ends on make the real
+// size differ by a few bytes at most.
+//
+// Input parameters:
+// counts: const uint16_t *: Normalized counts from ans_normalize()
+// log: uint32_t: log2 of the number of states they add up to
+// hist: const uint64_t *: Histogram of the block
+// total: uint64_t: Number of symbols in the block
+// Returns: uint64_t: Estimated size of the coded chunks
+uint64_t ans_coded_size(const uint16_t counts[static ALPHABET], uint32_t log, const uint64_t hist[static ALPHABET], uint64_t total) {
+    uint64_t chunks = (total + ANS_CHUNK - 1) / ANS_CHUNK;
+    double bits = 0;
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        if (hist[s] != 0) {
+            bits += hist[s] * (log - log2(counts[s]));
+        }
+    }
+    return (uint64_t) (bits / 8) + chunks * (ANS_CHUNK_HEADER + (log + 8) / 8);
+}
+
+// Lay the symbols out over the states, each as many times as its count,
+// stepping by about five eighths of the table so that each symbol's
+// states are spread evenly. The step is odd, so it visits every state.
+//
+// Input parameters:
+// counts: const uint16_t *: Normalized counts
+// log: uint32_t: log2 of the number of states
+// spread: uint8_t *: Filled in with the symbol of each state
+// Returns: void
+static void spread_symbols(const uint16_t counts[static ALPHABET], uint32_t log, uint8_t *spread) {
+    uint32_t mask = (1u << log) - 1;
+    uint32_t step = (mask + 1) / 2 + (mask + 1) / 8 + 3;
+    uint32_t pos = 0;
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        for (uint32_t i = 0; i < counts[s]; i++) {
+            spread[pos] = (uint8_t) s;
+            pos = (pos + step) & mask;
+        }
+    }
+    return;
+}
+
+// Build the table for coding a block from its histogram. The encoder's
+// state x is kept between 1 << log and 2 << log. Coding symbol s writes
+// out the low bits of x until it is between counts[s] and 2 * counts[s],
+// which is one of two bit counts, and then picks the next state from the
+// ones s is spread over. bits[s] is laid out so that the bit count is
+// (x + bits[s]) >> 16 either way.
+//
+// Input parameters:
+// a: AnsEncoder *: Encoder to build, which is also set up for a new block
+// hist: const uint64_t *: Histogram of the block
+// total: uint64_t: Number of symbols in the block, which must not be 0
+// Returns: void
+void ans_encoder_build(AnsEncoder *a, const uint64_t hist[static ALPHABET], uint64_t total) {
+    uint8_t spread[ANS_MAX_STATES];
+    uint32_t next[ALPHABET];
+    uint32_t states, cumulative = 0;
+
+    a->log = ans_normalize(a->counts, hist, total);
+    states = 1u << a->log;
+    spread_symbols(a->counts, a->log, spread);
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        uint32_t max_bits = a->counts[s] <= 1 ? a->log : a->log - high_bit(a->counts[s] - 1u);
+
+        next[s] = cumulative;
+        a->find[s] = (int32_t) cumulative - a->counts[s];
+        a->bits[s] = (max_bits << 16) - ((uint32_t) a->counts[s] << max_bits);
+        cumulative += a->counts[s];
+    }
+    for (uint32_t u = 0; u < states; u++) {
+        a->states[next[spread[u]]++] = (uint16_t) (states + u);
+    }
+    a->fill = 0;
+    a->coded = 0;
+    a->failed = false;
+    return;
+}
+
+// Lay the table out as it goes in the block, in place of a tree dump.
+//
+// Input parameters:
+// a: AnsEncoder *: Encoder whose table to pack
+// buf: uint8_t []: Buffer of ANS_MAX_TABLE bytes for it
+// Returns: uint32_t: Size of the packed table
+uint32_t ans_pack_table(AnsEncoder *a, uint8_t buf[static ANS_MAX_TABLE]) {
+    uint32_t size = 1 + ALPHABET / 8;
+
+    memset(buf, 0, size);
+    buf[0] = (uint8_t) a->log;
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        if (a->counts[s] != 0) {
+            buf[1 + s / 8] |= (uint8_t) (1u << (s % 8));
+            store_le(buf + size, a->counts[s], 2);
+            size += 2;
+        }
+    }
+    return size;
+}
+
+// Code a chunk, from its last symbol to its first, so that it decodes
+// first to last. The bits go into an accumulator that is stored whole
+// after every symbol, moving past the whole bytes in it, as in bulk.c.
+// The final state and a 1 bit to mark where the bits end come last.
+// Coding starts from the lowest state, so a decoder that ends anywhere
+// else knows the chunk is corrupt.
+//
+// Input parameters:
+// a: AnsEncoder *: Encoder to code with
+// in: const uint8_t *: Symbols of the chunk
+// n: uint32_t: Number of symbols
+// out: uint8_t *: Buffer of ANS_MAX_CODED + 8 bytes for the coded chunk
+// Returns: uint32_t: Size of the coded chunk
+static uint32_t encode_chunk(AnsEncoder *a, const uint8_t *in, uint32_t n, uint8_t *out) {
+    uint32_t states = 1u << a->log;
+    uint32_t x = states, count = 0, pos = 0;
+    uint64_t acc = 0;
+
+    for (uint32_t i = n; i-- > 0;) {
+        uint8_t s = in[i];
+        uint32_t nbits = (x + a->bits[s]) >> 16;
+
+        acc |= (uint64_t) (x & ((1u << nbits) - 1)) << count;
+        count += nbits;
+        x = a->states[(x >> nbits) + a->find[s]];
+        STORE_WORD(out + pos, acc);
+        pos += count >> 3;
+        acc >>= count & ~7u;
+        count &= 7;
+    }
+    acc |= (uint64_t) (x - states) << count;
+    count += a->log;
+    acc |= (uint64_t) 1 << count;
+    count += 1;
+    STORE_WORD(out + pos, acc);
+    return pos + (count + 7) / 8;
+}
+
+// Code the staged chunk, and write it out with its size before it.
+//
+// Input parameters:
+// a: AnsEncoder *: Encoder with a chunk staged
+// ofd: int: File descriptor to write to, or -1 to only count its size
+// Returns: void
+static void write_chunk(AnsEncoder *a, int ofd) {
+    uint32_t size = ANS_CHUNK_HEADER + encode_chunk(a, a->in, a->fill, a->out + ANS_CHUNK_HEADER);
+
+    store_le(a->out, size - ANS_CHUNK_HEADER, ANS_CHUNK_HEADER);
+    if (ofd >= 0) {
+        a->failed |= write_bytes(ofd, a->out, (int) size) != (int) size;
+    }
+    a->coded += size;
+    a->fill = 0;
+    return;
+}
+
+// Add symbols of a block, coding and writing each chunk once it is full.
+// With an ofd of -1, nothing is written, and only a->coded adds up, so
+// that the size of a block can be found before its header goes out. If
+// a write comes up short, a->failed is set.
+//
+// Input parameters:
+// a: AnsEncoder *: Encoder built for the block
+// in: const uint8_t *: Symbols to add
+// n: uint32_t: Number of symbols
+// ofd: int: File descriptor to write to, or -1
+// Returns: void
+void ans_encode(AnsEncoder *a, const uint8_t *in, uint32_t n, int ofd) {
+    while (n > 0) {
+        uint32_t m = ANS_CHUNK - a->fill < n ? ANS_CHUNK - a->fill : n;
+
+        memcpy(a->in + a->fill, in, m);
+        a->fill += m;
+        in += m;
+        n -= m;
+        if (a->fill == ANS_CHUNK) {
+            write_chunk(a, ofd);
+        }
+    }
+    return;
+}
+
+// Code and write the last, partial chunk of a block, and get ready for
+// another pass over it.
+//
+// Input parameters:
+// a: AnsEncoder *: Encoder built for the block
+// ofd: int: File descriptor to write to, or -1
+// Returns: uint64_t: Size the block coded to
+uint64_t ans_flush(AnsEncoder *a, int ofd) {
+    uint64_t coded;
+
+    if (a->fill > 0) {
+        write_chunk(a, ofd);
+    }
+    coded = a->coded;
+    a->coded = 0;
+    return coded;
+}
+
+// Build the decoding table from a packed table, checking that the
+// counts add up to the number of states. State u decodes to the symbol
+// spread over it. Counting the states of that symbol from its count up
+// gives x, which is shifted up until it is a whole state again, and the
+// bits shifted in are read from the chunk.
+//
+// Input parameters:
+// d: AnsDecoder *: Decoder to build
+// table: const uint8_t *: Packed table
+// size: uint32_t: Size of the packed table
+// Returns: bool: false if the table is malformed, true otherwise
+bool ans_decoder_build(AnsDecoder *d, const uint8_t *table, uint32_t size) {
+    uint16_t counts[ALPHABET] = { 0 };
+    uint8_t spread[ANS_MAX_STATES];
+    uint32_t next[ALPHABET];
+    uint32_t pos = 1 + ALPHABET / 8, sum = 0, states;
+
+    if (size < pos || table[0] < ANS_MIN_LOG || table[0] > ANS_MAX_LOG) {
+        return false;
+    }
+    d->log = table[0];
+    states = 1u << d->log;
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        if (((table[1 + s / 8] >> (s % 8)) & 1) == 0) {
+            continue;
+        }
+        if (size - pos < 2) {
+            return false;
+        }
+        counts[s] = (uint16_t) load_le(table + pos, 2);
+        pos += 2;
+        if (counts[s] == 0 || counts[s] > states) {
+            return false;
+        }
+        sum += counts[s];
+    }
+    if (pos != size || sum != states) {
+        return false;
+    }
+
+    spread_symbols(counts, d->log, spread);
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        next[s] = counts[s];
+    }
+    for (uint32_t u = 0; u < states; u++) {
+        uint32_t x = next[spread[u]]++;
+        uint32_t nbits = d->log - high_bit(x);
+
+        d->table[u].next = (uint16_t) ((x << nbits) - states);
+        d->table[u].symbol = spread[u];
+        d->table[u].bits = (uint8_t) nbits;
+    }
+    return true;
+}
+
+// Start decoding a chunk of size bytes, read into d->buf. The bits end
+// at the highest set bit of the last byte, and the final state of the
+// encoder comes right before that.
+//
+// Input parameters:
+// d: AnsDecoder *: Decoder built for the block
+// size: uint32_t: Size of the chunk
+// Returns: bool: false if the chunk is malformed, true otherwise
+bool ans_chunk_begin(AnsDecoder *d, uint32_t size) {
+    if (size == 0 || size > ANS_MAX_CODED || d->buf[size - 1] == 0) {
+        return false;
+    }
+    memset(d->buf + size, 0, 8);
+    d->pos = (int64_t) (size - 1) * 8 + high_bit(d->buf[size - 1]);
+    if (d->pos < d->log) {
+        return false;
+    }
+    d->pos -= d->log;
+    d->state = read_bits(d->buf, d->pos, d->log);
+    return true;
+}
+
+// Decode n symbols of the chunk. A symbol reads at most log bits, so
+// when enough are left for all n, the loop runs without checking, and
+// is nothing but table lookups. Otherwise every read is checked.
+//
+// Input parameters:
+// d: AnsDecoder *: Decoder with a chunk begun
+// out: uint8_t *: Where the symbols go
+// n: uint32_t: Number of symbols
+// Returns: bool: false if the chunk runs out of bits, true otherwise
+bool ans_decode(AnsDecoder *d, uint8_t *out, uint32_t n) {
+    int64_t pos = d->pos;
+    uint32_t state = d->state;
+
+    if (pos >= (int64_t) n * d->log) {
+        for (uint32_t i = 0; i < n; i++) {
+            AnsEntry e = d->table[state];
+
+            out[i] = e.symbol;
+            pos -= e.bits;
+            state = e.next + read_bits(d->buf, pos, e.bits);
+        }
+    } else {
+        for (uint32_t i = 0; i < n; i++) {
+            AnsEntry e = d->table[state];
+
+            out[i] = e.symbol;
+            pos -= e.bits;
+            if (pos < 0) {
+                return false;
+            }
+            state = e.next + read_bits(d->buf, pos, e.bits);
+        }
+    }
+    d->pos = pos;
+    d->state = state;
+    return true;
+}
+
+// Check that a chunk decoded right: every bit of it was read, and it
+// ended on the state the encoder started from.
+//
+// Input parameters:
+// d: AnsDecoder *: Decoder that decoded the chunk
+// Returns: bool: true if the chunk is consistent, false otherwise
+bool ans_chunk_end(AnsDecoder *d) {
+    return d->pos == 0 && d->state == 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ANS_MIN_LOG      11 // log2 of the number of states for a small block.
+#define ANS_MAX_LOG      12 // log2 of the number of states for a large block.
+#define ANS_MAX_STATES   (1 << ANS_MAX_LOG)
+#define ANS_SMALL        (1 << 15) // Blocks smaller than this get ANS_MIN_LOG states.
+#define ANS_CHUNK        (4 * BLOCK) // Symbols coded from one starting state.
+#define ANS_CHUNK_HEADER 4 // Size of the u32 coded size before each chunk.
+#define ANS_MAX_CODED    (ANS_CHUNK * ANS_MAX_LOG / 8 + 8) // Most bytes a chunk codes to.
+#define ANS_MAX_TABLE    (1 + ALPHABET / 8 + 2 * ALPHABET) // Most bytes a packed table takes.
+
+// A BLOCK_ANS block is coded with table-based asymmetric numeral systems
+// (tANS) instead of a Huffman tree. In place of the tree dump, it holds
+// its table: a u8 log2 of the number of states, a bitmap of the symbols
+// that occur, lowest symbol in the lowest bit, and a u16 normalized count
+// for each of them, which add up to the number of states. Its coded bytes
+// are the block ANS_CHUNK symbols at a time, each chunk as a u32 size and
+// that many bytes, which decode from the last byte back to the first.
+
+// A table for coding a block, and the chunk being staged for it. The
+// input is coded back to front, so a whole chunk is gathered first.
+typedef struct {
+    uint32_t log; // log2 of the number of states.
+    uint16_t counts[ALPHABET]; // Counts normalized to 1 << log.
+    uint16_t states[ANS_MAX_STATES]; // Next state, by symbol and sub-state.
+    int32_t find[ALPHABET]; // Where each symbol's next states start, less its count.
+    uint32_t bits[ALPHABET]; // Added to the state, the bits to write is in the high half.
+    uint8_t in[ANS_CHUNK];
+    uint32_t fill;
+    uint8_t out[ANS_CHUNK_HEADER + ANS_MAX_CODED + 8];
+    uint64_t coded; // Bytes the block has coded to so far.
+    bool failed; // Whether a chunk of the block was not written in full.
+} AnsEncoder;
+
+// What a state decodes to: a symbol, and the next state, which is next
+// plus the bits that follow.
+typedef struct {
+    uint16_t next;
+    uint8_t symbol;
+    uint8_t bits;
+} AnsEntry;
+
+// A table for decoding a block, and the chunk being decoded, which is
+// read backwards from pos.
+typedef struct {
+    uint32_t log;
+    AnsEntry table[ANS_MAX_STATES];
+    uint8_t buf[ANS_MAX_CODED + 8];
+    int64_t pos; // Bits of buf left to read.
+    uint32_t state;
+} AnsDecoder;
+
+uint32_t ans_normalize(uint16_t counts[static ALPHABET], const uint64_t hist[static ALPHABET], uint64_t total);
+
+uint64_t ans_coded_size(const uint16_t counts[static ALPHABET], uint32_t log, const uint64_t hist[static ALPHABET], uint64_t total);
+
+void ans_encoder_build(AnsEncoder *a, const uint64_t hist[static ALPHABET], uint64_t total);
+
+uint32_t ans_pack_table(AnsEncoder *a, uint8_t buf[static ANS_MAX_TABLE]);
+
+void ans_encode(AnsEncoder *a, const uint8_t *in, uint32_t n, int ofd);
+
+uint64_t ans_flush(AnsEncoder *a, int ofd);
+
+bool ans_decoder_build(AnsDecoder *d, const uint8_t *table, uint32_t size);
+
+bool ans_chunk_begin(AnsDecoder *d, uint32_t size);
+
+bool ans_decode(AnsDecoder *d, uint8_t *out, uint32_t n);
+
+bool ans_chunk_end(AnsDecoder *d);
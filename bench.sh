@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Benchmark for the compression levels. Encodes every FILE at each level
+# from -1 to -9, decodes the result again and compares it with the
+# original, and reports the total ratio and the encode and decode speed
+# for each level, which traces out the speed/ratio curve. With no FILEs,
+# the corpus is the sources and documents in this directory; pass a
+# standard corpus such as Silesia or Canterbury for numbers that compare
+# with other coders. Level 5 is then run again with each entropy coder
+# forced, Huffman and tANS, to compare the two.
+#
+# With --perf-counters, the largest FILE is encoded and decoded once more
+# at each level with hardware counters on, after the timed runs, and the
+# per-stage report of each is printed under the level.
+#
+# Last, bench_small times single calls on inputs of up to 4KB, coded as
+# small objects and as version 2 files, taken from the FILEs in turn.
+#
+# Usage: ./bench.sh [--perf-counters] [FILE...]
+
+PERF=
+if [ "$1" = "--perf-counters" ]; then
+    PERF=$1
+    shift
+fi
+if [ $# -eq 0 ]; then
+    set -- input_text DESIGN.pdf *.c *.h
+fi
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+TOTAL=0
+LARGEST=$1
+for f in "$@"; do
+    TOTAL=$((TOTAL + $(stat -c %s "$f")))
+    [ "$(stat -c %s "$f")" -gt "$(stat -c %s "$LARGEST")" ] && LARGEST=$f
+done
+
+echo "$# files, $TOTAL bytes"
+printf "%-14s %12s %8s %12s %12s\n" options bytes ratio "encode MB/s" "decode MB/s"
+for opts in -1 -2 -3 -4 -5 -6 -7 -8 -9 "-5 -e huffman" "-5 -e ans"; do
+    SIZE=0
+    ENCODE=0
+    DECODE=0
+    for f in "$@"; do
+        START=$(date +%s.%N)
+        ./encode $opts -i "$f" -o "$DIR/enc" || exit 1
+        MID=$(date +%s.%N)
+        ./decode -i "$DIR/enc" -o "$DIR/dec" || exit 1
+        END=$(date +%s.%N)
+        cmp -s "$f" "$DIR/dec" || { echo "Round trip of $f with $opts failed"; exit 1; }
+        SIZE=$((SIZE + $(stat -c %s "$DIR/enc")))
+        ENCODE=$(awk -v a="$ENCODE" -v s="$START" -v e="$MID" 'BEGIN { print a + e - s }')
+        DECODE=$(awk -v a="$DECODE" -v s="$MID" -v e="$END" 'BEGIN { print a + e - s }')
+    done
+    awk -v l="$opts" -v n="$SIZE" -v b="$TOTAL" -v e="$ENCODE" -v d="$DECODE" 'BEGIN {
+        printf "%-14s %12d %8.4f %12.1f %12.1f\n", l, n, n / b, b / e / 1e6, b / d / 1e6
+    }'
+    if [ -n "$PERF" ]; then
+        echo "  encode $LARGEST:"
+        ./encode $opts $PERF -i "$LARGEST" -o "$DIR/enc" 2>&1 | sed 's/^/    /'
+        echo "  decode $LARGEST:"
+        ./decode $PERF -i "$DIR/enc" -o "$DIR/dec" 2>&1 | sed 's/^/    /'
+    fi
+done
+
+echo
+./bench_small "$@"
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include "decoder.h"
+#include "encoder.h"
+#include "header.h"
+#include "small.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CALLS      2000 // Calls timed for each size, by default.
+#define CORPUS_MAX (1 << 24) // Most bytes read from the FILEs.
+
+static Encoder encoder;
+static Decoder decoder;
+
+// Read the clock, in nanoseconds.
+//
+// Returns: double: Nanoseconds since an arbitrary point
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Encode and decode calls objects of n bytes, taken in turn from the
+// corpus, once with small_encode() and small_decode() in memory, and once
+// through encode_file() and decode_file() in version 2, the way every
+// object was coded before small objects. Those go through memory backed
+// files, and decode in --verify mode, so the disk plays no part.
+//
+// Input parameters:
+// corpus: uint8_t *: Bytes to take the objects from
+// size: size_t: Size of the corpus, at least n
+// n: uint32_t: Size of each object
+// calls: uint32_t: Number of objects to code
+// Returns: void
+static void bench_size(uint8_t *corpus, size_t size, uint32_t n, uint32_t calls) {
+    uint8_t obj[SMALL_MAX_SIZE], out[SMALL_MAX];
+    EncodeOptions opts = { 0 };
+    int ifd = memfd_create("bench_in", 0), ofd = memfd_create("bench_out", 0);
+    double start, small_encode_ns = 0, small_decode_ns = 0, file_encode_ns = 0, file_decode_ns = 0;
+    uint64_t small_bytes = 0, file_bytes = 0;
+    uint32_t m, checksum;
+    Header header;
+
+    opts.version = HEADER_VERSION;
+    for (uint32_t i = 0; i < calls; i++) {
+        uint8_t *in = corpus + (uint64_t) i * n % (size - n + 1);
+        uint32_t obj_size;
+
+        start = now();
+        obj_size = small_encode(in, n, 0644, obj);
+        small_encode_ns += now() - start;
+        start = now();
+        if (small_decode(obj, obj_size, out, &m, &checksum) == false || m != n) {
+            fprintf(stderr, "Small object of %u bytes did not decode\n", n);
+            exit(EXIT_FAILURE);
+        }
+        small_decode_ns += now() - start;
+        small_bytes += obj_size;
+
+        ftruncate(ifd, 0);
+        pwrite(ifd, in, n, 0);
+        lseek(ifd, 0, SEEK_SET);
+        ftruncate(ofd, 0);
+        lseek(ofd, 0, SEEK_SET);
+        start = now();
+        encode_file(&encoder, ifd, ofd, 0644, &opts);
+        file_encode_ns += now() - start;
+        file_bytes += encoder.out_size;
+        lseek(ofd, 0, SEEK_SET);
+        start = now();
+        if (read_header(ofd, &header) == false
+            || decode_file(&decoder, ofd, -1, &header) != DECODE_OK) {
+            fprintf(stderr, "Version 2 file of %u bytes did not decode\n", n);
+            exit(EXIT_FAILURE);
+        }
+        file_decode_ns += now() - start;
+    }
+    printf("%-6u %10.0f %10.0f %8.4f %10.0f %10.0f %8.4f\n", n, small_encode_ns / calls,
+        small_decode_ns / calls, (double) small_bytes / calls / n, file_encode_ns / calls,
+        file_decode_ns / calls, (double) file_bytes / calls / n);
+    close(ifd);
+    close(ofd);
+    return;
+}
+
+// Report the latency of a call to encode and decode objects of up to
+// SMALL_MAX bytes, and their ratio, as small objects and as version 2
+// files. The objects are taken from the FILEs, one after another.
+//
+// Usage: ./bench_small [-n CALLS] FILE...
+//
+// Input parameters:
+// argc: int: Number of input arguments
+// argv: char **: The input arguments
+// Returns: int: 0 in case of success, non-zero for failure
+int main(int argc, char **argv) {
+    const uint32_t sizes[] = { 64, 256, 1024, SMALL_MAX };
+    uint32_t calls = CALLS;
+    uint8_t *corpus = (uint8_t *) malloc(CORPUS_MAX);
+    size_t size = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                calls = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            default:
+                calls = 0;
+                break;
+        }
+    }
+    if (corpus == NULL || calls == 0 || optind == argc) {
+        fprintf(stderr, "USAGE: %s [-n CALLS] FILE...\n", argv[0]);
+        return 1;
+    }
+    for (int i = optind; i < argc && size < CORPUS_MAX; i++) {
+        FILE *f = fopen(argv[i], "rb");
+
+        if (f == NULL) {
+            fprintf(stderr, "Cannot open %s\n", argv[i]);
+            return 1;
+        }
+        size += fread(corpus + size, 1, CORPUS_MAX - size, f);
+        fclose(f);
+    }
+    if (size < SMALL_MAX) {
+        fprintf(stderr, "The files come to fewer than %u bytes\n", SMALL_MAX);
+        return 1;
+    }
+
+    printf("Per call, in ns, over %u objects of each size\n", calls);
+    printf("%-6s %10s %10s %8s %10s %10s %8s\n", "bytes", "small enc", "small dec", "ratio",
+        "v2 enc", "v2 dec", "ratio");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_size(corpus, size, sizes[i], calls);
+    }
+    free(corpus);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "bulk.h"
+
+#include <string.h>
+
+// Store the 64-bit accumulator at out, lowest bits in the first byte.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define STORE_WORD(out, acc) memcpy((out), &(acc), 8)
+#else
+#define STORE_WORD(out, acc)                                                                       \
+    do {                                                                                           \
+        for (int b = 0; b < 8; b++) {                                                              \
+            (out)[b] = (uint8_t) ((acc) >> (8 * b));                                               \
+        }                                                                                          \
+    } while (0)
+#endif
+
+// Add the code for one symbol to the accumulator.
+#define ADD_CODE(s)                                                                                \
+    do {                                                                                           \
+        acc |= t->codes[(s)] << count;                                                             \
+        count += t->lengths[(s)];                                                                  \
+    } while (0)
+
+// Store the accumulator and move past the whole bytes in it. The bytes
+// after pos are always zero, so storing all eight of them is harmless,
+// and the partial byte left at pos is stored again with the next codes.
+#define STORE_CODES()                                                                              \
+    do {                                                                                           \
+        STORE_WORD(w->buf + pos, acc);                                                             \
+        pos += count >> 3;                                                                         \
+        acc >>= count & ~7u;                                                                       \
+        count &= 7;                                                                                \
+    } while (0)
+
+// Bulk kernel that adds K codes per store. At most 7 bits are left over
+// from the last store, and every code is at most BULK_MAX_LENGTH / K
+// bits long, so the K of them always fit in the accumulator. The buffer
+// is written out whenever an 8-byte store might run past its end. The
+// writer is left as write_code() would have, so that it can be flushed
+// or added to as usual.
+#define ENCODE_KERNEL(K)                                                                           \
+    static void encode_##K(EncodeTable *t, const uint8_t *in, size_t n, BitWriter *w) {            \
+        size_t pos = w->index >> 3;                                                                \
+        uint32_t count = w->index & 7;                                                             \
+        uint64_t acc = w->buf[pos];                                                                \
+        size_t i = 0;                                                                              \
+                                                                                                   \
+        for (; i + (K) <= n; i += (K)) {                                                           \
+            if (pos > BLOCK - 8) {                                                                 \
+                w->failed |= write_bytes(w->fd, w->buf, (int) pos) != (int) pos;                   \
+                memset(w->buf, 0, BLOCK);                                                          \
+                pos = 0;                                                                           \
+            }                                                                                      \
+            for (int k = 0; k < (K); k++) {                                                        \
+                ADD_CODE(in[i + k]);                                                               \
+            }                                                                                      \
+            STORE_CODES();                                                                         \
+        }                                                                                          \
+        for (; i < n; i++) {                                                                       \
+            if (pos > BLOCK - 8) {                                                                 \
+                w->failed |= write_bytes(w->fd, w->buf, (int) pos) != (int) pos;                   \
+                memset(w->buf, 0, BLOCK);                                                          \
+                pos = 0;                                                                           \
+            }                                                                                      \
+            ADD_CODE(in[i]);                                                                       \
+            STORE_CODES();                                                                         \
+        }                                                                                          \
+        w->buf[pos] = (uint8_t) acc;                                                               \
+        w->index = (uint32_t) (pos * 8 + count);                                                   \
+        return;                                                                                    \
+    }
+
+ENCODE_KERNEL(4)
+ENCODE_KERNEL(2)
+ENCODE_KERNEL(1)
+
+// Fallback for trees with codes longer than BULK_MAX_LENGTH, which only
+// very skewed histograms of huge inputs give.
+//
+// Input parameters:
+// t: EncodeTable *: Table whose original codes are written
+// in: const uint8_t *: Symbols to encode
+// n: size_t: Number of symbols
+// w: BitWriter *: Writer to add the codes to
+// Returns: void
+static void encode_slow(EncodeTable *t, const uint8_t *in, size_t n, BitWriter *w) {
+    for (size_t i = 0; i < n; i++) {
+        write_code(w, &t->table[in[i]]);
+    }
+    return;
+}
+
+// Flatten a code table for encode_block(), and pick the kernel that
+// adds the most codes per store that its longest code allows. The table
+// is kept for the fallback, so it must outlive t.
+//
+// Input parameters:
+// t: EncodeTable *: Table to fill in
+// table: Code *: Code for each symbol, as built by build_codes()
+// Returns: void
+void encode_table_build(EncodeTable *t, Code table[static ALPHABET]) {
+    t->max_length = 0;
+    t->table = table;
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        uint32_t length = code_size(&table[s]);
+        uint64_t bits = 0;
+
+        for (uint32_t i = 0; i < length && i < 64; i++) {
+            bits |= (uint64_t) code_get_bit(&table[s], i) << i;
+        }
+        t->codes[s] = bits;
+        t->lengths[s] = (uint8_t) length;
+        if (length > t->max_length) {
+            t->max_length = length;
+        }
+    }
+
+    if (t->max_length <= BULK_MAX_LENGTH / 4) {
+        t->encode = encode_4;
+    } else if (t->max_length <= BULK_MAX_LENGTH / 2) {
+        t->encode = encode_2;
+    } else if (t->max_length <= BULK_MAX_LENGTH) {
+        t->encode = encode_1;
+    } else {
+        t->encode = encode_slow;
+    }
+    return;
+}
+
+// Add the codes for n symbols to the writer. This is the same as calling
+// write_code() for each of them, but several codes are combined into a
+// 64-bit word at a time, and written to the buffer with a single store.
+//
+// Input parameters:
+// t: EncodeTable *: Table built by encode_table_build()
+// in: const uint8_t *: Symbols to encode
+// n: size_t: Number of symbols
+// w: BitWriter *: Writer to add the codes to
+// Returns: void
+void encode_block(EncodeTable *t, const uint8_t *in, size_t n, BitWriter *w) {
+    t->encode(t, in, n, w);
+    return;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "io.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define BULK_MAX_LENGTH 56 // Longest code the bulk kernels can add at once.
+
+typedef struct EncodeTable EncodeTable;
+
+// The code table flattened for the bulk kernels: each code is kept as
+// the bits it is written as, lowest first, next to its length. The
+// kernel picked depends on the longest code, which decides how many
+// codes fit in one 64-bit store. Codes too long for any of them fall
+// back to write_code() on the original table.
+struct EncodeTable {
+    uint64_t codes[ALPHABET];
+    uint8_t lengths[ALPHABET];
+    uint32_t max_length;
+    Code *table;
+    void (*encode)(EncodeTable *t, const uint8_t *in, size_t n, BitWriter *w);
+};
+
+void encode_table_build(EncodeTable *t, Code table[static ALPHABET]);
+
+void encode_block(EncodeTable *t, const uint8_t *in, size_t n, BitWriter *w);
@@ -0,0 +1,330 @@
+#include "cache.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Bytes of each entry saved to the cache file.
+#define ENTRY_SIZE (offsetof(CachedTree, has_table))
+
+// FNV-1a hash of a buffer.
+//
+// Input parameters:
+// buf: uint8_t *: Bytes to hash
+// nbytes: uint32_t: Number of bytes
+// Returns: uint64_t: The hash
+static uint64_t hash_bytes(uint8_t *buf, uint32_t nbytes) {
+    uint64_t h = 0xcbf29ce484222325;
+
+    for (uint32_t i = 0; i < nbytes; i++) {
+        h = (h ^ buf[i]) * 0x100000001b3;
+    }
+    return h;
+}
+
+// Reduce a histogram to a signature that similar histograms share. Each
+// symbol's -log2 of its probability is rounded down, which is close to
+// the code length a tree would give it, and capped at 14. Absent symbols
+// count as 0, so that a tree is never matched with a histogram that has
+// symbols it cannot code.
+//
+// Input parameters:
+// hist: uint64_t *: Histogram to sign
+// Returns: uint64_t: The signature
+static uint64_t signature(uint64_t hist[static ALPHABET]) {
+    uint8_t q[ALPHABET];
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        total += hist[i];
+    }
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        double bits = hist[i] ? log2((double) total / hist[i]) : 0;
+        q[i] = hist[i] ? (uint8_t) (1 + (bits < 14 ? bits : 14)) : 0;
+    }
+    return hash_bytes(q, ALPHABET);
+}
+
+// Grow the entries array so that one more fits. The cache is left as it
+// was if there is no memory for that.
+//
+// Input parameters:
+// c: TreeCache *: Cache to grow
+// Returns: bool: false if there is no memory to grow it, true otherwise
+static bool reserve(TreeCache *c) {
+    CachedTree **grown;
+    uint32_t capacity;
+
+    if (c->count == c->capacity) {
+        capacity = c->capacity ? 2 * c->capacity : CACHE_ENTRIES;
+        grown = (CachedTree **) realloc(c->entries, capacity * sizeof(CachedTree *));
+        if (grown == NULL) {
+            return false;
+        }
+        c->entries = grown;
+        c->capacity = capacity;
+    }
+    return true;
+}
+
+// Move entry i to the front, as the most recently used.
+//
+// Input parameters:
+// c: TreeCache *: Cache to reorder
+// i: uint32_t: Index of the entry
+// Returns: void
+static void touch(TreeCache *c, uint32_t i) {
+    CachedTree *t = c->entries[i];
+
+    memmove(c->entries + 1, c->entries, i * sizeof(CachedTree *));
+    c->entries[0] = t;
+    return;
+}
+
+// Open a cache file, reading whatever trees it holds. A file that does
+// not exist yet gives an empty cache, which cache_save() creates. Trees
+// that fail to parse are dropped. Running out of memory fails the whole
+// cache instead, since files may refer to any tree in it, and saving it
+// would lose the rest.
+//
+// Input parameters:
+// path: const char *: Path of the cache file
+// Returns: TreeCache *: The cache, NULL if the file is not a cache file or does not fit in memory
+TreeCache *cache_open(const char *path) {
+    TreeCache *c = (TreeCache *) calloc(1, sizeof(TreeCache));
+    Node nodes[MAX_NODES];
+    uint32_t magic = 0, count = 0;
+    int fd;
+
+    if (c == NULL) {
+        return NULL;
+    }
+    if ((c->path = strdup(path)) == NULL) {
+        cache_close(&c);
+        return NULL;
+    }
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        return c;
+    }
+    if (read_bytes(fd, (uint8_t *) &magic, sizeof(magic)) != sizeof(magic)
+        || magic != CACHE_MAGIC
+        || read_bytes(fd, (uint8_t *) &count, sizeof(count)) != sizeof(count)) {
+        close(fd);
+        cache_close(&c);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        CachedTree *t = (CachedTree *) calloc(1, sizeof(CachedTree));
+
+        if (t == NULL || reserve(c) == false) {
+            free(t);
+            close(fd);
+            cache_close(&c);
+            return NULL;
+        }
+        if (read_bytes(fd, (uint8_t *) t, ENTRY_SIZE) != (int) ENTRY_SIZE) {
+            free(t);
+            break;
+        }
+        if (t->tree_size > MAX_TREE_SIZE || rebuild_tree(t->tree_size, t->tree, nodes) == NULL) {
+            free(t);
+            continue;
+        }
+        c->entries[c->count++] = t;
+    }
+    close(fd);
+    return c;
+}
+
+// Write the cache back to its file, most recently used first. The file
+// is written beside the old one and renamed over it only once it is
+// written in full, so that a reader never sees it half written, and a
+// failed save leaves the old file as it was.
+//
+// Input parameters:
+// c: TreeCache *: Cache to save
+// Returns: bool: false if the file cannot be written, true otherwise
+bool cache_save(TreeCache *c) {
+    size_t len = strlen(c->path);
+    char *tmp = (char *) malloc(len + 5);
+    uint32_t magic = CACHE_MAGIC;
+    bool ok;
+    int fd;
+
+    if (tmp == NULL) {
+        return false;
+    }
+    memcpy(tmp, c->path, len);
+    memcpy(tmp + len, ".tmp", 5);
+    if ((fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644)) == -1) {
+        free(tmp);
+        return false;
+    }
+    ok = write_bytes(fd, (uint8_t *) &magic, sizeof(magic)) == sizeof(magic);
+    ok &= write_bytes(fd, (uint8_t *) &c->count, sizeof(c->count)) == sizeof(c->count);
+    for (uint32_t i = 0; i < c->count && ok == true; i++) {
+        ok &= write_bytes(fd, (uint8_t *) c->entries[i], ENTRY_SIZE) == (int) ENTRY_SIZE;
+    }
+    ok &= close(fd) == 0;
+    if (ok == false) {
+        unlink(tmp);
+    }
+    ok = ok && rename(tmp, c->path) == 0;
+    free(tmp);
+    return ok;
+}
+
+// Free a cache, without saving it.
+//
+// Input parameters:
+// c: TreeCache **: Cache to free
+// Returns: void
+void cache_close(TreeCache **c) {
+    for (uint32_t i = 0; i < (*c)->count; i++) {
+        free((*c)->entries[i]);
+    }
+    free((*c)->entries);
+    free((*c)->path);
+    free(*c);
+    *c = NULL;
+    return;
+}
+
+// Build the code table of a cached tree, if it has not been yet.
+//
+// Input parameters:
+// t: CachedTree *: Tree whose table to build
+// Returns: void
+static void build_table(CachedTree *t) {
+    Node nodes[MAX_NODES];
+
+    if (t->has_table == false) {
+        build_codes(rebuild_tree(t->tree_size, t->tree, nodes), t->table);
+        t->has_table = true;
+    }
+    return;
+}
+
+// Count the bits a cached tree would code hist in.
+//
+// Input parameters:
+// t: CachedTree *: Tree with its table built
+// hist: uint64_t *: Histogram to code
+// Returns: uint64_t: Coded bits, UINT64_MAX if the tree lacks a symbol of hist
+static uint64_t tree_cost(CachedTree *t, uint64_t hist[static ALPHABET]) {
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        if (hist[i] != 0 && code_size(&t->table[i]) == 0) {
+            return UINT64_MAX;
+        }
+    }
+    return coded_bits(hist, t->table);
+}
+
+// Look for a recently used tree to code hist with, instead of building
+// a new one. A tree is only used if it codes every symbol of hist, and
+// within CACHE_SLACK of its entropy, which is about as well as any tree
+// could. A tree built for a histogram with the same signature is tried
+// first, as the likeliest fit; failing that, the cheapest of the recent
+// trees is taken if it is close enough. A hit makes the tree the most
+// recently used. Hits and misses are counted.
+//
+// Input parameters:
+// c: TreeCache *: Cache to look in
+// hist: uint64_t *: Histogram to code
+// Returns: CachedTree *: The tree to use, with its table built, NULL if there is none
+CachedTree *cache_find(TreeCache *c, uint64_t hist[static ALPHABET]) {
+    uint64_t sig = signature(hist);
+    uint64_t total = 0, best_cost = UINT64_MAX;
+    uint32_t best = 0;
+    double entropy = 0;
+
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        total += hist[i];
+    }
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        if (hist[i] != 0) {
+            entropy += hist[i] * log2((double) total / hist[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < c->count && i < CACHE_ENTRIES; i++) {
+        CachedTree *t = c->entries[i];
+        uint64_t cost;
+
+        build_table(t);
+        cost = tree_cost(t, hist);
+        if (t->signature == sig && cost <= entropy * (1 + CACHE_SLACK)) {
+            best = i;
+            best_cost = cost;
+            break;
+        }
+        if (cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    if (best_cost == UINT64_MAX || best_cost > entropy * (1 + CACHE_SLACK)) {
+        c->misses += 1;
+        return NULL;
+    }
+    touch(c, best);
+    c->hits += 1;
+    return c->entries[0];
+}
+
+// Add a newly built tree to the front of the cache. If the same tree is
+// already cached, it is moved to the front instead. If there is no
+// memory for it, it is left out, which only loses later hits, since the
+// block it was built for carries its dump.
+//
+// Input parameters:
+// c: TreeCache *: Cache to add to
+// hist: uint64_t *: Histogram the tree was built for
+// tree: uint8_t *: Tree dump
+// tree_size: uint16_t: Size of the dump
+// Returns: uint64_t: The id of the tree
+uint64_t cache_insert(TreeCache *c, uint64_t hist[static ALPHABET], uint8_t *tree, uint16_t tree_size) {
+    uint64_t id = hash_bytes(tree, tree_size);
+    CachedTree *t;
+
+    for (uint32_t i = 0; i < c->count; i++) {
+        if (c->entries[i]->id == id) {
+            touch(c, i);
+            return id;
+        }
+    }
+    t = (CachedTree *) calloc(1, sizeof(CachedTree));
+    if (t == NULL || reserve(c) == false) {
+        free(t);
+        return id;
+    }
+    t->id = id;
+    t->signature = signature(hist);
+    t->tree_size = tree_size;
+    memcpy(t->tree, tree, tree_size);
+    c->entries[c->count++] = t;
+    touch(c, c->count - 1);
+    return id;
+}
+
+// Find a tree by its id, for decoding a block that refers to it.
+//
+// Input parameters:
+// c: TreeCache *: Cache to look in
+// id: uint64_t: Id of the tree
+// Returns: CachedTree *: The tree, NULL if the cache does not have it
+CachedTree *cache_lookup(TreeCache *c, uint64_t id) {
+    for (uint32_t i = 0; i < c->count; i++) {
+        if (c->entries[i]->id == id) {
+            return c->entries[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_MAGIC   0x48554643 // "HUFC", at the start of a cache file.
+#define CACHE_ENTRIES 16 // Most recently used trees considered for reuse.
+#define CACHE_SLACK   0.03 // Reuse a tree that codes within 3% of the entropy.
+
+// A tree kept for reuse. Only the fields up to table are saved to the
+// cache file; the code table is built the first time it is needed.
+typedef struct {
+    uint64_t id; // Hash of the tree dump, which blocks refer to it by.
+    uint64_t signature; // Hash of the quantized histogram it was built for.
+    uint16_t tree_size;
+    uint8_t tree[MAX_TREE_SIZE];
+    bool has_table;
+    Code table[ALPHABET];
+} CachedTree;
+
+// Trees from earlier files, most recently used first. Every tree ever
+// added is kept, since files on disk may still refer to it, but only the
+// first CACHE_ENTRIES are considered for reuse.
+typedef struct {
+    CachedTree **entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+    char *path;
+} TreeCache;
+
+TreeCache *cache_open(const char *path);
+
+bool cache_save(TreeCache *c);
+
+void cache_close(TreeCache **c);
+
+CachedTree *cache_find(TreeCache *c, uint64_t hist[static ALPHABET]);
+
+uint64_t cache_insert(TreeCache *c, uint64_t hist[static ALPHABET], uint8_t *tree, uint16_t tree_size);
+
+CachedTree *cache_lookup(TreeCache *c, uint64_t id);
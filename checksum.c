@@ -0,0 +1,152 @@
+#include "checksum.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // Reflected Castagnoli polynomial.
+
+static uint32_t crc_table[8][256];
+static bool crc_table_ready = false;
+
+// Fill in the tables used by the software CRC. Table 0 is the classic
+// byte-at-a-time table, and table k advances a byte by k more zero bytes,
+// which lets crc32c_sw() fold 8 bytes per iteration.
+//
+// Input parameters: None
+// Returns: void
+static void crc32c_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        }
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc_table[k - 1][i];
+            crc_table[k][i] = (prev >> 8) ^ crc_table[0][prev & 0xff];
+        }
+    }
+    crc_table_ready = true;
+    return;
+}
+
+// Software CRC32C, slicing 8 bytes at a time.
+//
+// Input parameters:
+// crc: uint32_t: Running CRC, already inverted
+// buf: const uint8_t *: Bytes to add to the CRC
+// nbytes: size_t: Number of bytes in buf
+// Returns: uint32_t: Updated, still inverted CRC
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t nbytes) {
+    if (!crc_table_ready) {
+        crc32c_init_table();
+    }
+    while (nbytes >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        word ^= crc;
+        crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff]
+              ^ crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff]
+              ^ crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff]
+              ^ crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+        buf += 8;
+        nbytes -= 8;
+    }
+    while (nbytes-- > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Hardware CRC32C using the SSE4.2 crc32 instruction.
+//
+// Input parameters:
+// crc: uint32_t: Running CRC, already inverted
+// buf: const uint8_t *: Bytes to add to the CRC
+// nbytes: size_t: Number of bytes in buf
+// Returns: uint32_t: Updated, still inverted CRC
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(
+    uint32_t crc, const uint8_t *buf, size_t nbytes) {
+    uint64_t crc64 = crc;
+
+    while (nbytes >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        nbytes -= 8;
+    }
+    crc = (uint32_t) crc64;
+    while (nbytes-- > 0) {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+    return crc;
+}
+#endif
+
+// Add nbytes from buf to a CRC32C (Castagnoli) checksum. Pass 0 as the
+// crc to start a new checksum, and the previous result to continue one.
+// The SSE4.2 instruction is used when the CPU has it.
+//
+// Input parameters:
+// crc: uint32_t: Checksum of the bytes seen so far
+// buf: const uint8_t *: Bytes to add to the checksum
+// nbytes: size_t: Number of bytes in buf
+// Returns: uint32_t: Checksum including buf
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t nbytes) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c_hw(~crc, buf, nbytes);
+    }
+#endif
+    return ~crc32c_sw(~crc, buf, nbytes);
+}
+
+// Multiply two polynomials modulo the CRC32C polynomial. Both are
+// reflected, as the CRC is, so x^0 is the top bit.
+//
+// Input parameters:
+// a: uint32_t: First polynomial
+// b: uint32_t: Second polynomial
+// Returns: uint32_t: a * b modulo the polynomial
+static uint32_t crc32c_multiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+
+    for (uint32_t m = (uint32_t) 1 << 31; m != 0; m >>= 1) {
+        if ((a & m) != 0) {
+            product ^= b;
+        }
+        b = (b >> 1) ^ (CRC32C_POLY & (0 - (b & 1)));
+    }
+    return product;
+}
+
+// Work out the checksum of two runs of bytes one after the other from
+// the checksums of each, without the bytes. Appending nbytes2 bytes
+// multiplies the first checksum by x^(8 * nbytes2), which is found by
+// repeated squaring, in time logarithmic in nbytes2.
+//
+// Input parameters:
+// crc1: uint32_t: Checksum of the first run
+// crc2: uint32_t: Checksum of the second run
+// nbytes2: uint64_t: Length of the second run
+// Returns: uint32_t: Checksum of both runs
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t nbytes2) {
+    uint32_t shift = (uint32_t) 1 << 31; // x^0
+    uint32_t square = (uint32_t) 1 << 23; // x^8, one byte.
+
+    for (; nbytes2 != 0; nbytes2 >>= 1) {
+        if ((nbytes2 & 1) != 0) {
+            shift = crc32c_multiply(square, shift);
+        }
+        square = crc32c_multiply(square, square);
+    }
+    return crc32c_multiply(shift, crc1) ^ crc2;
+}
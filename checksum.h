@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t nbytes);
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t nbytes2);
@@ -1,28 +1,33 @@
-#include "defines.h"
+#include "decoder.h"
 #include "header.h"
-#include "huffman.h"
-#include "io.h"
-#include "node.h"
 
 #include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-Code c;
+static Decoder decoder;
 
 // Usage Function
 // Input parameters:
 // exec_name: char *: Name of the program
 // Returns: void
 void usage(char *exec_name) {
-    printf("USAGE: %s [-i <infile>][-o <outfile>][-vh]\n", exec_name);
+    printf("USAGE: %s [-i <infile>][-o <outfile>][-c <cache>][-mtvh][--perf-counters]\n", exec_name);
     printf("-i <infile>: Input file to decode. Default is stdin\n");
     printf("-o <outfile>: File to write the decompressed output to. Default is "
            "stdout\n");
+    printf("-c <cache>: Tree cache file that the input was encoded with\n");
+    printf("-m: Decode in a fixed workspace sized from the header, and allocate nothing "
+           "else\n");
+    printf("-t, --verify: Check the checksums without writing any output\n");
     printf("-v: Print compression statistics to stderr\n");
+    printf("--perf-counters: Print the time, IPC and cache and branch misses per byte of "
+           "each stage to stderr\n");
     printf("-h: Print this message\n");
     return;
 }
@@ -37,22 +42,37 @@ int main(int argc, char **argv) {
     int opt;
     char *infile = NULL;
     char *outfile = NULL;
+    char *cachefile = NULL;
     int ifd = 0;
     int ofd = 1;
     bool verbose = false;
-    uint8_t buf[BLOCK];
+    bool verify = false;
+    bool bounded = false;
+    bool perf = false;
+    void *workspace = NULL;
+    size_t workspace_size = 0;
+    uint64_t total = 0, files = 0;
+    bool end = false;
+    Decoder *d = &decoder;
+    TreeCache *cache = NULL;
     Header header;
-    Node *root, *n;
-    uint8_t bit;
-    uint16_t tree_size;
-    uint64_t file_size;
+    DecodeStatus status;
+    struct option long_options[] = {
+        { "verify", no_argument, NULL, 't' },
+        { "perf-counters", no_argument, NULL, 'P' },
+        { NULL, 0, NULL, 0 },
+    };
 
     // Parse the input options.
-    while ((opt = getopt(argc, argv, "i:o:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:c:mtvh", long_options, NULL)) != -1) {
         switch (opt) {
         case ('i'): infile = optarg; break;
         case ('o'): outfile = optarg; break;
+        case ('c'): cachefile = optarg; break;
+        case ('m'): bounded = true; break;
+        case ('t'): verify = true; break;
         case ('v'): verbose = true; break;
+        case ('P'): perf = true; break;
         case ('h'): usage(argv[0]); return 0;
         default: usage(argv[0]); exit(EXIT_FAILURE);
         }
@@ -65,48 +85,79 @@ int main(int argc, char **argv) {
         }
     }
 
-    read(ifd, &header, sizeof(header));
+    if (cachefile != NULL && (cache = cache_open(cachefile)) == NULL) {
+        printf("%s is not a tree cache file, or does not fit in memory\n", cachefile);
+        return 1;
+    }
 
-    if (header.magic != 0xBEEFBBAD) {
-        printf("The magic number is not 0xBEEFBBAD.\n");
-        printf("The input file is not correctly encoded\n");
+    if (read_header(ifd, &header) == false) {
+        printf("The input file is not correctly encoded, or needs a newer decoder\n");
         return 1;
     }
 
-    if (outfile != NULL) {
-        if ((ofd = open(outfile, O_CREAT | O_WRONLY | O_TRUNC)) == -1) {
+    if (perf == true) {
+        decoder.perf = perf_create();
+    }
+
+    if (verify == true) {
+        ofd = -1;
+    } else if (outfile != NULL) {
+        if ((ofd = open(outfile, O_CREAT | O_RDWR | O_TRUNC, 0600)) == -1) {
             printf("Unable to open output file for writing\n");
             return 1;
         }
         fchmod(ofd, header.permissions);
     }
 
-    tree_size = header.tree_size;
-    file_size = header.file_size;
-    read_bytes(ifd, buf, tree_size);
-    root = rebuild_tree(tree_size, buf);
+    // A file size limit makes the write that crosses it fail, rather than
+    // kill the process, so that the failure is reported.
+    signal(SIGXFSZ, SIG_IGN);
 
-    n = root;
-    uint64_t decoded_symbols_count = 0;
-    while (decoded_symbols_count < file_size) {
-        if (n == NULL) {
-            continue;
-        }
-        if (n->left == NULL && n->right == NULL) { // Leaf node
-            write_bytes(ofd, &(n->symbol), 1);
-            n = root;
-            decoded_symbols_count += 1;
-        } else {
-            read_bit(ifd, &bit);
-            if (bit == 0) {
-                n = n->left;
-            } else {
-                n = n->right;
+    // Encoded files can be concatenated, such as the shards of a dataset
+    // coded with one histogram, and each is decoded in turn onto the end
+    // of the output. Bytes after a trailer that do not start another
+    // encoded file are an error.
+    do {
+        // The whole workspace is allocated up front, and the decoder
+        // never asks for more, unless a later file needs more room.
+        if (bounded == true && decode_memory(&header) > workspace_size) {
+            free(workspace);
+            workspace_size = decode_memory(&header);
+            if ((workspace = malloc(workspace_size)) == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+            d = decoder_init(workspace, workspace_size, &header);
+            if (verbose == true) {
+                fprintf(stderr, "Decode workspace = %lu bytes\n", (unsigned long) workspace_size);
             }
         }
+        d->cache = cache;
+        d->perf = decoder.perf;
+        status = decode_file(d, ifd, ofd, &header);
+        total += header.file_size;
+        files += 1;
+    } while (status == DECODE_OK && read_next_header(ifd, &header, &end) == true);
+    if (decoder.perf != NULL) {
+        perf_report(decoder.perf, total, stderr);
+        perf_delete(&decoder.perf);
+    }
+    if (status != DECODE_OK) {
+        fprintf(stderr, "%s\n", decode_error(status));
+        return 1;
+    }
+    if (end == false) {
+        fprintf(stderr, "The input has bytes after its trailer that are not an encoded file\n");
+        return 1;
     }
 
-    if (verbose == true) {
+    if (verbose == true && verify == true && files > 1) {
+        fprintf(stderr, "%lu bytes verified, in %lu files\n", (unsigned long) total,
+            (unsigned long) files);
+    } else if (verbose == true && verify == true) {
+        fprintf(stderr, "%lu bytes verified, checksum %08x\n", (unsigned long) total,
+            d->file_crc);
+    } else if (verbose == true) {
         // Obtain size of the output file
         struct stat ifd_buffer, ofd_buffer;
         double i_size, o_size;
@@ -115,16 +166,20 @@ int main(int argc, char **argv) {
         fstat(ofd, &ofd_buffer);
         i_size = (double) ifd_buffer.st_size;
         o_size = (double) ofd_buffer.st_size;
-        printf("Compressed file size = %ld bytes\n", (long) i_size);
-        printf("Decompressed file size = %ld bytes\n", (long) o_size);
-        printf("Decompression size change = %0.2f%%\n", (1 - (i_size / o_size)) * 100);
+        fprintf(stderr, "Compressed file size = %ld bytes\n", (long) i_size);
+        fprintf(stderr, "Decompressed file size = %ld bytes\n", (long) o_size);
+        fprintf(stderr, "Decompression size change = %0.2f%%\n", (1 - (i_size / o_size)) * 100);
     }
 
+    if (cache != NULL) {
+        cache_close(&cache);
+    }
+    free(workspace);
     if (ifd != 0) {
         close(ifd);
     }
-    if (ofd != 1) {
+    if (ofd > 1) {
         close(ofd);
     }
-    delete_tree(&root);
+    return 0;
 }
@@ -0,0 +1,598 @@
+#define _GNU_SOURCE
+#include "decoder.h"
+#include "cache.h"
+#include "checksum.h"
+#include "defines.h"
+#include "huffman.h"
+#include "io.h"
+#include "small.h"
+#include "wide.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Most symbols one coded byte can decode to. A tANS chunk of ANS_CHUNK
+// symbols takes at least its ANS_CHUNK_HEADER bytes, which no other
+// block type comes near. On top of that, a run-length coded run of
+// RLE_MIN copies and a count, RLE_MIN + 1 symbols, expands to at most
+// RLE_MIN + RLE_MAX bytes, rounded up here.
+#define MAX_EXPANSION (ANS_CHUNK / ANS_CHUNK_HEADER)
+#define RLE_EXPANSION ((RLE_MIN + RLE_MAX + RLE_MIN) / (RLE_MIN + 1))
+
+// Point d->out at where the next bytes should be decoded to. With the
+// output mapped, that is their place in the mapping, as long as a whole
+// BLOCK fits before the end of the file, so that a block that decodes
+// past the file size cannot write past the mapping. Otherwise, and for
+// run-length coded files, whose bytes are not yet the output, it is
+// out_buf.
+//
+// Input parameters:
+// d: Decoder *: Decoder to stage output in
+// Returns: void
+static void next_output(Decoder *d) {
+    d->out = d->out_buf;
+    if (d->map != NULL && d->use_rle == false && d->remaining >= BLOCK) {
+        d->out = d->map + d->file_size - d->remaining;
+    }
+    return;
+}
+
+// Add the staged output to the checksums, and write it to ofd, or into
+// the output mapping where it was not decoded there already. Nothing is
+// written when ofd is negative, which is how --verify runs. When the
+// file is run-length coded, the block checksum covers the staged bytes,
+// and the file checksum what they expand to. Expanding past the size of
+// the file sets d->overflow, and stops. A write that comes up short sets
+// d->write_failed, and nothing more is written.
+//
+// Input parameters:
+// d: Decoder *: Decoder whose output is staged
+// ofd: int: File descriptor of the decoded file
+// Returns: void
+static void flush_output(Decoder *d, int ofd) {
+    uint8_t *buf = d->out;
+    int used = 0, n = d->out_index;
+
+    perf_enter(d->perf, PERF_OUTPUT);
+    d->block_crc = crc32c(d->block_crc, d->out, d->out_index);
+    do {
+        if (d->overflow == true) {
+            break;
+        }
+        if (d->use_rle == true) {
+            used += rle_decode(&d->rle, d->out_buf + used, d->out_index - used, d->rle_buf, BLOCK, &n);
+            buf = d->rle_buf;
+        }
+        if ((uint64_t) n > d->remaining) {
+            d->overflow = true;
+            break;
+        }
+        d->file_crc = crc32c(d->file_crc, buf, n);
+        if (d->map != NULL && buf != d->map + d->file_size - d->remaining) {
+            memcpy(d->map + d->file_size - d->remaining, buf, n);
+        } else if (d->map == NULL && ofd >= 0 && d->write_failed == false) {
+            d->write_failed = write_bytes(ofd, buf, n) != n;
+        }
+        d->remaining -= n;
+    } while (d->use_rle == true && (used < d->out_index || n == BLOCK));
+    d->out_index = 0;
+    next_output(d);
+    return;
+}
+
+// Copy a stored block of nbytes from ifd to ofd. The bytes are read to
+// d->out, since they have to be checksummed on the way.
+//
+// Input parameters:
+// d: Decoder *: Decoder to stage the bytes in
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// nbytes: uint64_t: Size of the stored block
+// Returns: bool: false if the input ends early, true otherwise
+static bool copy_stored(Decoder *d, int ifd, int ofd, uint64_t nbytes) {
+    while (nbytes > 0) {
+        int chunk = nbytes < BLOCK ? (int) nbytes : BLOCK;
+
+        perf_enter(d->perf, PERF_INPUT);
+        if (read_bytes(ifd, d->out, chunk) != chunk) {
+            return false;
+        }
+        d->out_index = chunk;
+        flush_output(d, ofd);
+        nbytes -= chunk;
+    }
+    return true;
+}
+
+// Pack the tree from its dump, and decode nsymbols symbols from ifd
+// with it into ofd. The symbols are decoded BLOCK at a time by the
+// kernel that table_build() picks for the tree.
+//
+// Input parameters:
+// d: Decoder *: Decoder to decode with
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// tree: uint8_t *: Tree dump
+// tree_size: uint16_t: Size of the tree dump
+// nsymbols: uint64_t: Number of symbols to decode
+// coded_size: uint64_t: Number of coded bytes after the tree dump
+// Returns: bool: false if the input is corrupted or ends early, true otherwise
+static bool decode_symbols(Decoder *d, int ifd, int ofd, uint8_t *tree, uint16_t tree_size, uint64_t nsymbols, uint64_t coded_size) {
+    perf_enter(d->perf, PERF_TREE);
+    if (pack_tree(tree_size, tree, d->table.tree) == false) {
+        return false;
+    }
+
+    // Every symbol takes at least one bit, so a tree that is a single
+    // leaf, or more symbols than coded bits, cannot be right.
+    if ((d->table.tree[0] & PACKED_LEAF) || (coded_size < UINT64_MAX / 8 && nsymbols > coded_size * 8)) {
+        return false;
+    }
+
+    table_build(&d->table, nsymbols);
+    bit_reader_init(&d->reader, ifd, coded_size);
+    while (nsymbols > 0) {
+        uint32_t n = nsymbols < BLOCK ? (uint32_t) nsymbols : BLOCK;
+
+        perf_enter(d->perf, PERF_CODE);
+        d->table.decode(&d->table, &d->reader, d->out, n);
+
+        // Running out of bits before all the symbols are decoded
+        // means that the file is truncated or its sizes are wrong.
+        if (bit_reader_overrun(&d->reader)) {
+            return false;
+        }
+        d->out_index = n;
+        flush_output(d, ofd);
+        nsymbols -= n;
+    }
+    return true;
+}
+
+// Read the tree dump that follows in ifd, and decode with it.
+//
+// Input parameters:
+// d: Decoder *: Decoder to decode with
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// tree_size: uint16_t: Size of the tree dump
+// nsymbols: uint64_t: Number of symbols to decode
+// coded_size: uint64_t: Number of coded bytes after the tree dump
+// Returns: bool: false if the input is corrupted or ends early, true otherwise
+static bool decode_dumped(Decoder *d, int ifd, int ofd, uint16_t tree_size, uint64_t nsymbols, uint64_t coded_size) {
+    uint8_t buf[MAX_TREE_SIZE];
+
+    if (tree_size > MAX_TREE_SIZE || read_bytes(ifd, buf, tree_size) != tree_size) {
+        return false;
+    }
+    return decode_symbols(d, ifd, ofd, buf, tree_size, nsymbols, coded_size);
+}
+
+// Read the id of a cached tree that follows in ifd, and decode with
+// that tree from d->cache.
+//
+// Input parameters:
+// d: Decoder *: Decoder to decode with
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// tree_size: uint16_t: Size of the tree id
+// nsymbols: uint64_t: Number of symbols to decode
+// coded_size: uint64_t: Number of coded bytes after the tree id
+// Returns: DecodeStatus: DECODE_OK, DECODE_CORRUPT, or DECODE_NO_TREE if the tree is not cached
+static DecodeStatus decode_cached(Decoder *d, int ifd, int ofd, uint16_t tree_size, uint64_t nsymbols, uint64_t coded_size) {
+    CachedTree *t;
+    uint8_t id[sizeof(t->id)];
+
+    if (tree_size != sizeof(id) || read_bytes(ifd, id, sizeof(id)) != sizeof(id)) {
+        return DECODE_CORRUPT;
+    }
+    if (d->cache == NULL || (t = cache_lookup(d->cache, load_le(id, sizeof(id)))) == NULL) {
+        return DECODE_NO_TREE;
+    }
+    if (decode_symbols(d, ifd, ofd, t->tree, t->tree_size, nsymbols, coded_size) == false) {
+        return DECODE_CORRUPT;
+    }
+    return DECODE_OK;
+}
+
+// Decode a BLOCK_ANS block of nsymbols bytes into ofd: read its table,
+// then each chunk in turn, which has to fit the bytes left in the block,
+// decode all of it, and end where the encoder started.
+//
+// Input parameters:
+// d: Decoder *: Decoder to decode with
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// table_size: uint16_t: Size of the table
+// nsymbols: uint64_t: Number of symbols to decode
+// coded_size: uint64_t: Number of coded bytes after the table
+// Returns: bool: false if the input is corrupted or ends early, true otherwise
+static bool decode_ans(Decoder *d, int ifd, int ofd, uint16_t table_size, uint64_t nsymbols, uint64_t coded_size) {
+    uint8_t table[ANS_MAX_TABLE];
+
+    perf_enter(d->perf, PERF_TREE);
+    if (table_size > ANS_MAX_TABLE || read_bytes(ifd, table, table_size) != table_size
+        || ans_decoder_build(&d->ans, table, table_size) == false) {
+        return false;
+    }
+    while (nsymbols > 0) {
+        uint32_t chunk = nsymbols < ANS_CHUNK ? (uint32_t) nsymbols : ANS_CHUNK;
+        uint8_t header[ANS_CHUNK_HEADER];
+        uint32_t size;
+
+        perf_enter(d->perf, PERF_INPUT);
+        if (coded_size < ANS_CHUNK_HEADER
+            || read_bytes(ifd, header, ANS_CHUNK_HEADER) != ANS_CHUNK_HEADER
+            || (size = (uint32_t) load_le(header, ANS_CHUNK_HEADER)) > ANS_MAX_CODED
+            || size > coded_size - ANS_CHUNK_HEADER
+            || read_bytes(ifd, d->ans.buf, (int) size) != (int) size
+            || ans_chunk_begin(&d->ans, size) == false) {
+            return false;
+        }
+        coded_size -= ANS_CHUNK_HEADER + size;
+        for (uint32_t left = chunk; left > 0;) {
+            uint32_t n = left < BLOCK ? left : BLOCK;
+
+            perf_enter(d->perf, PERF_CODE);
+            if (ans_decode(&d->ans, d->out, n) == false) {
+                return false;
+            }
+            d->out_index = n;
+            flush_output(d, ofd);
+            left -= n;
+        }
+        if (ans_chunk_end(&d->ans) == false) {
+            return false;
+        }
+        nsymbols -= chunk;
+    }
+    return coded_size == 0;
+}
+
+// Decode a BLOCK_WIDE block of raw_size bytes into ofd. The table of
+// code lengths is read and checked first, and must leave room in the
+// block for at least a bit per symbol. The table is built in d->wide,
+// or in a WideWorkspace allocated for the block if there is none.
+//
+// Input parameters:
+// d: Decoder *: Decoder to decode with
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// raw_size: uint64_t: Size of the block once decoded
+// coded_size: uint64_t: Size of the block in ifd
+// Returns: DecodeStatus: DECODE_OK, DECODE_CORRUPT, or DECODE_NO_MEMORY if d may not or cannot allocate
+static DecodeStatus decode_wide(Decoder *d, int ifd, int ofd, uint64_t raw_size, uint64_t coded_size) {
+    uint64_t nsymbols = raw_size / 2;
+    uint32_t odd = raw_size & 1;
+    uint8_t size[sizeof(uint32_t)];
+    uint32_t table_size;
+    WideWorkspace *ws = d->wide;
+    WideTable *t = NULL;
+
+    if (ws == NULL && d->bounded == true) {
+        return DECODE_NO_MEMORY;
+    }
+    if (coded_size < sizeof(table_size) + odd
+        || read_bytes(ifd, size, sizeof(size)) != sizeof(size)
+        || (table_size = (uint32_t) load_le(size, sizeof(size))) > WIDE_ALPHABET * WIDE_ENTRY_SIZE
+        || table_size > coded_size - sizeof(table_size) - odd) {
+        return DECODE_CORRUPT;
+    }
+    coded_size -= sizeof(table_size) + table_size + odd;
+    if (nsymbols > coded_size * 8) {
+        return DECODE_CORRUPT;
+    }
+    if (d->wide == NULL && (ws = (WideWorkspace *) malloc(sizeof(WideWorkspace))) == NULL) {
+        return DECODE_NO_MEMORY;
+    }
+    perf_enter(d->perf, PERF_TREE);
+    if (read_bytes(ifd, ws->dump, table_size) == (int) table_size) {
+        t = wide_table_build(ws, table_size);
+    }
+
+    bit_reader_init(&d->reader, ifd, coded_size);
+    while (t != NULL && nsymbols > 0) {
+        uint32_t n = nsymbols < BLOCK / 2 ? (uint32_t) nsymbols : BLOCK / 2;
+
+        perf_enter(d->perf, PERF_CODE);
+        wide_decode(t, &d->reader, d->out, n);
+        if (bit_reader_overrun(&d->reader)) {
+            t = NULL;
+            break;
+        }
+        d->out_index = 2 * n;
+        flush_output(d, ofd);
+        nsymbols -= n;
+    }
+    if (d->wide == NULL) {
+        free(ws);
+    }
+    if (t == NULL) {
+        return DECODE_CORRUPT;
+    }
+    if (odd != 0) {
+        if (read_bytes(ifd, d->out, 1) != 1) {
+            return DECODE_CORRUPT;
+        }
+        d->out_index = 1;
+        flush_output(d, ofd);
+    }
+    return DECODE_OK;
+}
+
+// Decode a small object, whose header has been read, into ofd. It is
+// read whole, decoded into d->out, and checked against its checksum.
+//
+// Input parameters:
+// d: Decoder *: Decoder to decode with
+// ifd: int: File descriptor of the encoded file
+// ofd: int: File descriptor of the decoded file
+// header: Header *: Header of the small object
+// Returns: DecodeStatus: DECODE_OK, DECODE_CORRUPT or DECODE_FILE_MISMATCH
+static DecodeStatus decode_small(Decoder *d, int ifd, int ofd, Header *header) {
+    uint8_t buf[SMALL_MAX_SIZE];
+    uint32_t size, n, checksum;
+
+    perf_enter(d->perf, PERF_INPUT);
+    if ((size = small_read(ifd, header->permissions, (uint16_t) header->file_size, buf)) == 0) {
+        return DECODE_CORRUPT;
+    }
+    perf_enter(d->perf, PERF_CODE);
+    if (small_decode(buf, size, d->out, &n, &checksum) == false) {
+        return DECODE_CORRUPT;
+    }
+    d->out_index = (int) n;
+    flush_output(d, ofd);
+    if (d->file_crc != checksum) {
+        return DECODE_FILE_MISMATCH;
+    }
+    return DECODE_OK;
+}
+
+// Work out from the header alone how much memory decoding the file
+// takes: a Decoder, and a WideWorkspace after it if the file may have
+// BLOCK_WIDE blocks. Nothing else is allocated while decoding.
+//
+// Input parameters:
+// header: Header *: Header read from the encoded file
+// Returns: size_t: Size of the workspace decoder_init() needs
+size_t decode_memory(Header *header) {
+    size_t size = sizeof(Decoder);
+
+    if (header->tree_size == 0 && (header->flags & HEADER_WIDE) != 0) {
+        size += sizeof(WideWorkspace);
+    }
+    return size;
+}
+
+// Set up a Decoder in a workspace of the caller's, for a file with the
+// given header. Decoding with it allocates nothing, so its memory use is
+// fixed at size. The workspace must be aligned as malloc() would align
+// it, and at least decode_memory() bytes long. The Decoder's cache can
+// be set once it is returned.
+//
+// Input parameters:
+// workspace: void *: Memory to decode in
+// size: size_t: Size of the workspace
+// header: Header *: Header read from the encoded file
+// Returns: Decoder *: Decoder at the start of workspace, NULL if it does not fit
+Decoder *decoder_init(void *workspace, size_t size, Header *header) {
+    Decoder *d = (Decoder *) workspace;
+
+    if (size < decode_memory(header) || (uintptr_t) workspace % _Alignof(Decoder) != 0) {
+        return NULL;
+    }
+    d->cache = NULL;
+    d->perf = NULL;
+    d->bounded = true;
+    d->wide = NULL;
+    if (decode_memory(header) > sizeof(Decoder)) {
+        d->wide = (WideWorkspace *) (d + 1);
+    }
+    return d;
+}
+
+// Map the output file, sized to the decoded size up front, so that the
+// blocks can be decoded straight into it instead of written. That needs
+// ofd to be a regular file opened for reading and writing, at its start.
+// Its blocks are allocated before anything is written, so that running
+// out of space fails here, and the output is streamed with write()
+// instead, rather than killing the process with SIGBUS halfway through.
+// Then it is cut back to empty, so that only what is written is left.
+//
+// The size comes from the header, before any block is checked, so it is
+// only trusted as far as the rest of ifd could decode to. ifd must be a
+// regular file for that to be known, and otherwise the output is
+// streamed too.
+//
+// Input parameters:
+// d: Decoder *: Decoder to set d->map of
+// ifd: int: File descriptor of the encoded file, positioned after the header
+// ofd: int: File descriptor of the decoded file
+// size: uint64_t: Size of the decoded file
+// Returns: void
+static void map_output(Decoder *d, int ifd, int ofd, uint64_t size) {
+    struct stat statbuf;
+    uint64_t limit;
+    off_t pos;
+    void *map;
+
+    d->map = NULL;
+    if (fstat(ifd, &statbuf) != 0 || S_ISREG(statbuf.st_mode) == false
+        || (pos = lseek(ifd, 0, SEEK_CUR)) == -1 || pos > statbuf.st_size) {
+        return;
+    }
+    limit = (uint64_t) (statbuf.st_size - pos) * MAX_EXPANSION * (d->use_rle == true ? RLE_EXPANSION : 1);
+    if (size == 0 || size > SIZE_MAX || size > limit || fstat(ofd, &statbuf) != 0
+        || S_ISREG(statbuf.st_mode) == false || (fcntl(ofd, F_GETFL) & O_ACCMODE) != O_RDWR
+        || lseek(ofd, 0, SEEK_CUR) != 0 || ftruncate(ofd, (off_t) size) != 0) {
+        return;
+    }
+    if (fallocate(ofd, 0, 0, (off_t) size) != 0 && errno != EOPNOTSUPP) {
+        ftruncate(ofd, 0);
+        return;
+    }
+    map = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, ofd, 0);
+    if (map == MAP_FAILED) {
+        ftruncate(ofd, 0);
+        return;
+    }
+    d->map = (uint8_t *) map;
+    return;
+}
+
+// Decode the blocks of a file, and its trailer. See decode_file().
+//
+// Input parameters:
+// d: Decoder *: Scratch space to decode with
+// ifd: int: File descriptor of the encoded file, positioned after the header
+// ofd: int: File descriptor of the decoded file, or -1
+// header: Header *: Header read from ifd
+// Returns: DecodeStatus: DECODE_OK on success, the reason for failure otherwise
+static DecodeStatus decode_blocks(Decoder *d, int ifd, int ofd, Header *header) {
+    BlockHeader block;
+    Trailer trailer;
+    uint64_t blocks = 0;
+
+    if (header->version == HEADER_SMALL_VERSION) {
+        return decode_small(d, ifd, ofd, header);
+    }
+    if (header->tree_size != 0) {
+        // Files with a single tree dump carry no checksums.
+        if (decode_dumped(d, ifd, ofd, header->tree_size, header->file_size, UINT64_MAX)
+            == false) {
+            return DECODE_CORRUPT;
+        }
+        return DECODE_OK;
+    }
+
+    // The body is a sequence of blocks. Keep going till every byte of
+    // the original file has been produced. A block can never be empty
+    // or run past the end of the file. Run-length coded blocks can only
+    // be checked for that as they are expanded. Once a write fails, there
+    // is no point going on.
+    while (d->remaining > 0 && d->write_failed == false) {
+        bool ok;
+        DecodeStatus status;
+
+        if (read_block_header(ifd, &block) == false || block.raw_size == 0
+            || (d->use_rle == false && block.raw_size > d->remaining)) {
+            return DECODE_CORRUPT;
+        }
+        d->block_crc = 0;
+        if (block.type == BLOCK_STORED) {
+            ok = copy_stored(d, ifd, ofd, block.raw_size);
+        } else if (block.type == BLOCK_HUFFMAN) {
+            ok = decode_dumped(d, ifd, ofd, block.tree_size, block.raw_size, block.coded_size);
+        } else if (block.type == BLOCK_CACHED) {
+            status = decode_cached(d, ifd, ofd, block.tree_size, block.raw_size, block.coded_size);
+            if (status == DECODE_NO_TREE) {
+                return status;
+            }
+            ok = status == DECODE_OK;
+        } else if (block.type == BLOCK_ANS) {
+            ok = decode_ans(d, ifd, ofd, block.tree_size, block.raw_size, block.coded_size);
+        } else if (block.type == BLOCK_WIDE) {
+            status = decode_wide(d, ifd, ofd, block.raw_size, block.coded_size);
+            if (status == DECODE_NO_MEMORY) {
+                return status;
+            }
+            ok = status == DECODE_OK;
+        } else {
+            ok = false;
+        }
+        if (ok == false || d->overflow == true) {
+            return DECODE_CORRUPT;
+        }
+        if (d->block_crc != block.checksum) {
+            return DECODE_BLOCK_MISMATCH;
+        }
+        blocks += 1;
+    }
+
+    if ((header->flags & HEADER_INDEX) != 0 && skip_index(ifd, blocks) == false) {
+        return DECODE_CORRUPT;
+    }
+    if (read_trailer(ifd, &trailer) == false || trailer.checksum != d->file_crc) {
+        return DECODE_FILE_MISMATCH;
+    }
+    return DECODE_OK;
+}
+
+// Decode everything that follows the header in ifd, and write it to
+// ofd. Nothing is written when ofd is negative, so that an archive can
+// be checked without producing output. Every size read from the file is
+// checked against what is left to decode, so that a corrupted file
+// fails instead of running away. The CRC32C of the decoded bytes is left
+// in d->file_crc.
+//
+// When ofd is a regular file opened with O_RDWR, it is sized to the
+// decoded size from the header and mapped, and the blocks are decoded
+// straight into the mapping, which saves the write() calls and the copy
+// out of the Decoder. ofd is left positioned at the end of the output,
+// and cut back to it if decoding fails, as if it had been written.
+// Anything else, such as a pipe, gets the output written to it as it is
+// decoded.
+//
+// Input parameters:
+// d: Decoder *: Scratch space to decode with
+// ifd: int: File descriptor of the encoded file, positioned after the header
+// ofd: int: File descriptor of the decoded file, or -1
+// header: Header *: Header read from ifd
+// Returns: DecodeStatus: DECODE_OK on success, the reason for failure otherwise
+DecodeStatus decode_file(Decoder *d, int ifd, int ofd, Header *header) {
+    DecodeStatus status;
+
+    d->out_index = 0;
+    d->file_crc = 0;
+    d->use_rle = header->tree_size == 0 && (header->flags & HEADER_RLE) != 0;
+    rle_init(&d->rle);
+    d->file_size = header->file_size;
+    d->remaining = header->file_size;
+    d->overflow = false;
+    d->write_failed = false;
+    d->map = NULL;
+    if (ofd >= 0) {
+        map_output(d, ifd, ofd, header->file_size);
+    }
+    next_output(d);
+
+    status = decode_blocks(d, ifd, ofd, header);
+    if (d->write_failed == true) {
+        status = DECODE_WRITE_FAILED;
+    }
+    if (d->map != NULL) {
+        munmap(d->map, (size_t) header->file_size);
+        if (status != DECODE_OK) {
+            ftruncate(ofd, (off_t) (header->file_size - d->remaining));
+        }
+        lseek(ofd, (off_t) (header->file_size - d->remaining), SEEK_SET);
+        d->map = NULL;
+    }
+    return status;
+}
+
+// Describe why decoding failed.
+//
+// Input parameters:
+// status: DecodeStatus: Status returned by decode_file()
+// Returns: const char *: Message for the user
+const char *decode_error(DecodeStatus status) {
+    switch (status) {
+    case DECODE_OK: return "No error";
+    case DECODE_CORRUPT: return "The input file is corrupted or truncated";
+    case DECODE_BLOCK_MISMATCH: return "Checksum mismatch in a block";
+    case DECODE_FILE_MISMATCH: return "Checksum mismatch for the whole file";
+    case DECODE_NO_TREE: return "The file refers to a tree that is not in the tree cache";
+    case DECODE_NO_MEMORY: return "The file needs more memory than the decode workspace, or the system, has";
+    case DECODE_WRITE_FAILED: return "Unable to write the output";
+    }
+    return "Unknown error";
+}
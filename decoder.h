@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ans.h"
+#include "cache.h"
+#include "defines.h"
+#include "header.h"
+#include "io.h"
+#include "perf.h"
+#include "rle.h"
+#include "table.h"
+#include "wide.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    DECODE_OK,
+    DECODE_CORRUPT,
+    DECODE_BLOCK_MISMATCH,
+    DECODE_FILE_MISMATCH,
+    DECODE_NO_TREE,
+    DECODE_NO_MEMORY,
+    DECODE_WRITE_FAILED,
+} DecodeStatus;
+
+// Scratch space for decoding one file at a time. Decoded bytes are staged
+// at out, so that they can be added to the checksums and written out
+// BLOCK bytes at a time. out is out_buf, or when the output is a regular
+// file, the place in a mapping of it where the bytes go, so that they are
+// decoded straight into the file. Run-length coded files are expanded
+// from out_buf into rle_buf on their way out. A Decoder can be reused for
+// any number of files, and each thread needs its own.
+//
+// Trees are packed into table, and tANS tables built in ans, so the only
+// memory a Decoder allocates is a WideWorkspace for each BLOCK_WIDE
+// block. One set up by decoder_init() allocates nothing at all, and
+// fails BLOCK_WIDE blocks that the header gave it no room for.
+typedef struct {
+    DecodeTable table;
+    BitReader reader;
+    uint8_t out_buf[BLOCK];
+    uint8_t *out; // Where the next bytes are decoded to.
+    int out_index;
+    uint8_t *map; // Mapping of the whole output file, or NULL.
+    uint32_t block_crc;
+    uint32_t file_crc;
+    bool use_rle;
+    RleState rle;
+    uint8_t rle_buf[BLOCK];
+    uint64_t file_size; // Size of the file being decoded.
+    uint64_t remaining; // Bytes of the file yet to be written out.
+    bool overflow; // Whether the blocks expanded past the file size.
+    bool write_failed; // Whether a write to the output came up short.
+    TreeCache *cache; // Trees that BLOCK_CACHED blocks refer to, or NULL.
+    AnsDecoder ans; // Table and chunk of the BLOCK_ANS block being decoded.
+    WideWorkspace *wide; // Room for BLOCK_WIDE tables, or NULL.
+    bool bounded; // Whether to fail instead of allocating.
+    PerfCounters *perf; // Counters to attribute to each stage, or NULL.
+} Decoder;
+
+size_t decode_memory(Header *header);
+
+Decoder *decoder_init(void *workspace, size_t size, Header *header);
+
+DecodeStatus decode_file(Decoder *d, int ifd, int ofd, Header *header);
+
+const char *decode_error(DecodeStatus status);
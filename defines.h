@@ -2,6 +2,15 @@
 
 #define BLOCK         4096 // 4KB blocks.
 #define ALPHABET      256 // ASCII + Extended ASCII.
-#define MAGIC         0xBEEFBBAD // 32-bit magic number.
+#define MAGIC         0xBEEFBBAD // 32-bit magic number of version 1 files.
+#define MAGIC_V2      0x32465548 // "HUF2", the magic number of later versions.
+#define MAGIC_SMALL   0x53465548 // "HUFS", the magic number of small objects.
 #define MAX_CODE_SIZE (ALPHABET / 8) // Bytes for a maximum, 256-bit code.
 #define MAX_TREE_SIZE (3 * ALPHABET - 1) // Maximum Huffman tree dump size.
+#define MAX_NODES     (2 * ALPHABET - 1) // Nodes in a tree of every symbol.
+
+#define BLOCK_HUFFMAN 0 // Block coded with its own Huffman tree.
+#define BLOCK_STORED  1 // Block copied through verbatim.
+#define BLOCK_WIDE    2 // Block coded as 16-bit symbols.
+#define BLOCK_CACHED  3 // Block coded with a tree from a tree cache.
+#define BLOCK_ANS     4 // Block coded with tANS, see ans.h.
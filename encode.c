@@ -1,8 +1,11 @@
+#include "encoder.h"
 #include "header.h"
-#include "huffman.h"
-#include "io.h"
+#include "histogram.h"
 
 #include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,49 +13,47 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-Code c;
+static Encoder encoder;
+static uint64_t given[ALPHABET]; // Counts read with --use-histogram.
 
 // Usage Function
 // Input parameters:
 // exec_name: char *: Name of the program
 // Returns: void
 void usage(char *exec_name) {
-    printf("USAGE: %s [-i <infile>][-o <outfile>][-vh]\n", exec_name);
+    printf("USAGE: %s [-i <infile>][-o <outfile>][-s <percent>][-c <cache>][-f <version>][-e <coder>][-1..-9][-bwrvh][--estimate][--append][--histogram-only][--use-histogram <histogram>][--perf-counters]\n", exec_name);
     printf("-i <infile>: Input file to encode. Default is stdin\n");
     printf("-o <outfile>: File to write the compressed output to. Default is "
            "stdout\n");
+    printf("-s <percent>: Estimate the histogram from this percentage of the input, "
+           "and read it in full only once\n");
+    printf("-c <cache>: Reuse trees from, and add them to, this tree cache file\n");
+    printf("-f <version>: Container format version to write, 1 or 2. Default is 2\n");
+    printf("-e <coder>: Entropy coder for each block: huffman, ans (tANS), or auto to "
+           "pick whichever codes the block smaller. Default is auto\n");
+    printf("-1 .. -9: Compression level, from fastest to smallest. Sets -s and -b, "
+           "which can be given after it to override it\n");
+    printf("-b: Split the input into blocks with their own trees where its content "
+           "changes\n");
+    printf("-w: Code the input as 16-bit little-endian symbols, for word or token "
+           "streams\n");
+    printf("-r: Run-length code the input first, for data with long runs of the "
+           "same byte\n");
     printf("-v: Print compression statistics to stderr\n");
+    printf("--estimate: Print the size the input would encode to as one block, its "
+           "entropy bound and the header overhead, and write no output\n");
+    printf("--append: Add the input to the end of the encoded file given with -o, as new "
+           "blocks, or encode it there if the file is empty or missing\n");
+    printf("--histogram-only: Write the byte counts of the input to the output as a "
+           "histogram file, for merge to sum with others, and code nothing\n");
+    printf("--use-histogram <histogram>: Build the tree from the counts in this histogram "
+           "file, such as one summed by merge, and read the input only once\n");
+    printf("--perf-counters: Print the time, IPC and cache and branch misses per byte of "
+           "each stage to stderr\n");
     printf("-h: Print this message\n");
     return;
 }
 
-// Create the frequency table for the input file. The file is read as
-// bytes, and each byte is used as an index into the histogram. Each time
-// the byte is encountered in the file, the frequency is incremented by 1.
-// To ensure that there are at least 2 nodes in the tree that's created
-// from this histogram, the first and the last frequency is incremented by 1.
-//
-// Input parameters:
-// infile: char *: Input file
-// h: uint64_t *: Pointer to the histogram
-// Returns: void
-void create_histogram(int ifd, uint64_t *h) {
-    uint8_t buf[BLOCK];
-    int num_bytes_read;
-
-    h[0] += 1;
-    h[ALPHABET - 1] += 1;
-
-    // Read the infile using read_bytes(). Use the byte value as an index
-    // to the histogram and increment the frequency by 1.
-    while ((num_bytes_read = read_bytes(ifd, buf, BLOCK)) != 0) {
-        for (int i = 0; i < num_bytes_read; i++) {
-            h[buf[i]] += 1;
-        }
-    }
-    return;
-}
-
 // The main function
 //
 // Input parameters:
@@ -63,29 +64,84 @@ int main(int argc, char **argv) {
     int opt;
     char *infile = NULL;
     char *outfile = NULL;
+    char *cachefile = NULL;
+    char *histfile = NULL;
     bool verbose = false;
-    uint64_t histogram[ALPHABET] = { 0 };
-    Node *root;
-    Code table[ALPHABET];
-    Header header;
+    bool perf = false;
+    bool estimate = false;
+    bool append = false;
+    bool histogram_only = false;
+    bool encoded;
+    EncodeOptions opts = { 0 };
     struct stat statbuf;
     int ifd = 0;
     int ofd = 1;
-    uint32_t hist_size = 0;
-    uint8_t buf[BLOCK];
-    int num_bytes_read;
+    struct option long_options[] = {
+        { "estimate", no_argument, NULL, 'E' },
+        { "append", no_argument, NULL, 'A' },
+        { "perf-counters", no_argument, NULL, 'P' },
+        { "histogram-only", no_argument, NULL, 'H' },
+        { "use-histogram", required_argument, NULL, 'U' },
+        { NULL, 0, NULL, 0 },
+    };
 
     // Parse the input options.
-    while ((opt = getopt(argc, argv, "i:o:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:s:c:f:e:bwrvh123456789", long_options, NULL)) != -1) {
         switch (opt) {
         case ('i'): infile = optarg; break;
         case ('o'): outfile = optarg; break;
+        case ('s'): opts.sample_percent = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case ('c'): cachefile = optarg; break;
+        case ('f'): opts.version = (uint8_t) strtoul(optarg, NULL, 10); break;
+        case ('e'):
+            if (strcmp(optarg, "huffman") == 0) {
+                opts.backend = ENCODE_HUFFMAN;
+            } else if (strcmp(optarg, "ans") == 0) {
+                opts.backend = ENCODE_ANS;
+            } else if (strcmp(optarg, "auto") == 0) {
+                opts.backend = ENCODE_AUTO;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case ('b'): opts.split = true; break;
+        case ('w'): opts.wide = true; break;
+        case ('r'): opts.rle = true; break;
         case ('v'): verbose = true; break;
+        case ('E'): estimate = true; break;
+        case ('A'): append = true; break;
+        case ('P'): perf = true; break;
+        case ('H'): histogram_only = true; break;
+        case ('U'): histfile = optarg; break;
         case ('h'): usage(argv[0]); return 0;
+        case ('1'):
+        case ('2'):
+        case ('3'):
+        case ('4'):
+        case ('5'):
+        case ('6'):
+        case ('7'):
+        case ('8'):
+        case ('9'): encode_level(&opts, opt - '0'); break;
         default: usage(argv[0]); exit(EXIT_FAILURE);
         }
     }
 
+    // Histograms count bytes as they are read, so they do not apply to
+    // 16-bit symbols or run-length coded bytes.
+    if (opts.version > HEADER_VERSION
+        || ((histogram_only == true || histfile != NULL) && (opts.wide == true || opts.rle == true))) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // The estimate is for a file coded as one block, from its own counts.
+    if (estimate == true && (opts.split == true || histfile != NULL)) {
+        fprintf(stderr, "--estimate cannot be used with -b, -6 to -9 or --use-histogram\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (infile != NULL) {
         if ((ifd = open(infile, O_RDONLY)) == -1) {
             printf("Unable to open input file for reading\n");
@@ -93,54 +149,156 @@ int main(int argc, char **argv) {
         }
     }
 
-    // Obtain permissions for the input file using fstat
-    fstat(ifd, &statbuf);
+    // Only the counts are written, for merge to sum with those of other
+    // inputs, without the padding that create_histogram() adds.
+    if (histogram_only == true) {
+        uint32_t crc = 0;
 
-    // Create a frequency table (histogram) for each symbol
-    // in the input file.
-    create_histogram(ifd, histogram);
+        create_histogram(&encoder, ifd, &crc);
+        encoder.histogram[0] -= 1;
+        encoder.histogram[ALPHABET - 1] -= 1;
+        if (outfile != NULL && (ofd = open(outfile, O_CREAT | O_WRONLY | O_TRUNC, 0644)) == -1) {
+            printf("Error opening output file\n");
+            return 1;
+        }
+        if (histogram_save(ofd, encoder.histogram) == false) {
+            fprintf(stderr, "Unable to write the histogram\n");
+            return 1;
+        }
+        if (ifd != 0) {
+            close(ifd);
+        }
+        if (ofd != 1) {
+            close(ofd);
+        }
+        return 0;
+    }
 
-    // Build a Huffman tree and code table from the histogram
-    root = build_tree(histogram);
-    c = code_init();
-    build_codes(root, table);
-    // print_codes(root, table);
+    if (cachefile != NULL && (opts.cache = cache_open(cachefile)) == NULL) {
+        printf("%s is not a tree cache file, or does not fit in memory\n", cachefile);
+        return 1;
+    }
 
-    header.magic = MAGIC;
-    if (outfile != NULL) {
-        if ((ofd = open(outfile, O_CREAT | O_WRONLY | O_TRUNC)) == -1) {
-            printf("Error opening output file\n");
+    if (histfile != NULL) {
+        int hfd = open(histfile, O_RDONLY);
+
+        if (hfd == -1 || histogram_load(hfd, given) == false) {
+            printf("%s is not a histogram file\n", histfile);
             return 1;
         }
-        fchmod(ofd, statbuf.st_mode);
+        close(hfd);
+        opts.histogram = given;
+    }
+
+    if (perf == true) {
+        encoder.perf = perf_create();
     }
-    header.permissions = statbuf.st_mode & 0777;
 
-    // Determine the number of unique symbols in the tree. This
-    // should be equal to the number of leaf nodes, which is also
-    // equal to the elements in histogram with non-zero frequencies.
+    // Only the histogram is needed to work out the sizes, so nothing
+    // is coded or written.
+    if (estimate == true) {
+        Estimate est;
 
-    hist_size = 0;
-    for (uint32_t i = 0; i < ALPHABET; i++) {
-        if (histogram[i] != 0) {
-            hist_size += 1;
+        if (estimate_file(&encoder, ifd, &opts, &est) == false) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        printf("Uncompressed file size = %lu bytes\n", (unsigned long) encoder.file_size);
+        printf("Coded size = %lu bytes\n", (unsigned long) est.coded_size);
+        printf("Entropy bound = %0.0f bytes\n", ceil(est.entropy));
+        printf("Tree size = %lu bytes\n", (unsigned long) est.tree_size);
+        if (est.ans_size != 0) {
+            printf("tANS size = %lu bytes\n", (unsigned long) est.ans_size);
+        }
+        printf("Header overhead = %lu bytes\n", (unsigned long) est.overhead);
+        printf("Compressed file size = %lu bytes\n", (unsigned long) est.out_size);
+        if (est.stored == true) {
+            printf("Input is incompressible, and would be stored as is\n");
+        }
+        if (encoder.sampled == true) {
+            printf("Histogram was sampled, so the sizes are estimates\n");
+        } else if (est.ans_size != 0) {
+            printf("tANS sizes come from its normalized counts, so the sizes are close, not "
+                   "exact\n");
+        } else if (est.approximate == true) {
+            printf("A cached tree may be reused, so the sizes are close, not exact\n");
         }
+        if (encoder.perf != NULL) {
+            perf_report(encoder.perf, encoder.file_size, stderr);
+            perf_delete(&encoder.perf);
+        }
+        if (opts.cache != NULL) {
+            cache_close(&opts.cache);
+        }
+        if (ifd != 0) {
+            close(ifd);
+        }
+        return 0;
     }
-    header.tree_size = (3 * hist_size) - 1;
-    header.file_size = statbuf.st_size;
 
-    write(ofd, &header, sizeof(header));
-    dump_tree(ofd, root);
+    // Obtain permissions for the input file using fstat
+    fstat(ifd, &statbuf);
 
-    lseek(ifd, 0, SEEK_SET);
-    while ((num_bytes_read = read_bytes(ifd, buf, BLOCK)) != 0) {
-        for (int i = 0; i < num_bytes_read; i++) {
-            write_code(ofd, &table[buf[i]]);
+    if (append == true && outfile == NULL) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (append == true) {
+        if ((ofd = open(outfile, O_CREAT | O_RDWR, 0600)) == -1) {
+            printf("Error opening output file\n");
+            return 1;
+        }
+        append = lseek(ofd, 0, SEEK_END) > 0;
+        // A small object has no block index, so a file that is to be
+        // appended to starts out as a version 2 file.
+        if (opts.version == 0) {
+            opts.version = HEADER_VERSION;
+        }
+    } else if (outfile != NULL) {
+        if ((ofd = open(outfile, O_CREAT | O_WRONLY | O_TRUNC)) == -1) {
+            printf("Error opening output file\n");
+            return 1;
         }
     }
-    flush_codes(ofd);
+    if (outfile != NULL && append == false) {
+        fchmod(ofd, statbuf.st_mode);
+    }
 
-    if (verbose == true) {
+    // A file size limit makes the write that crosses it fail, rather than
+    // kill the process, so that the failure is reported.
+    signal(SIGXFSZ, SIG_IGN);
+    if (append == true) {
+        encoded = encode_append(&encoder, ifd, ofd, &opts);
+    } else {
+        encoded = encode_file(&encoder, ifd, ofd, statbuf.st_mode & 0777, &opts);
+    }
+    if (encoded == false && encoder.no_memory == true) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    } else if (encoded == false && encoder.write_failed == true && append == true) {
+        fprintf(stderr, "Unable to write the output, so it was left as it was\n");
+        return 1;
+    } else if (encoded == false && encoder.write_failed == true) {
+        fprintf(stderr, "Unable to write the output\n");
+        return 1;
+    } else if (encoded == false && append == true) {
+        fprintf(stderr, "Can only append a regular file, without -r, to a file encoded "
+                        "with a block index and without -r\n");
+        return 1;
+    } else if (encoded == false) {
+        fprintf(stderr, "The input must be a regular file, since it is read twice\n");
+        return 1;
+    }
+
+    if (opts.cache != NULL && cache_save(opts.cache) == false) {
+        fprintf(stderr, "Unable to save the tree cache\n");
+    }
+
+    if (verbose == true && append == true) {
+        fprintf(stderr, "Appended %lu bytes, and the file now holds %lu bytes in %lu blocks\n",
+            (unsigned long) encoder.file_size, (unsigned long) encoder.position,
+            (unsigned long) encoder.blocks);
+    } else if (verbose == true) {
         // Obtain size of the output file
         struct stat ofd_buffer;
         double i_size, o_size;
@@ -148,11 +306,37 @@ int main(int argc, char **argv) {
         fstat(ofd, &ofd_buffer);
         i_size = (double) statbuf.st_size;
         o_size = (double) ofd_buffer.st_size;
-        printf("Uncompressed file size = %ld bytes\n", (long) i_size);
-        printf("Compressed file size = %ld bytes\n", (long) o_size);
-        printf("Compression gain = %0.2f%%\n", (1 - (o_size / i_size)) * 100);
+        fprintf(stderr, "Uncompressed file size = %ld bytes\n", (long) i_size);
+        fprintf(stderr, "Compressed file size = %ld bytes\n", (long) o_size);
+        fprintf(stderr, "Compression gain = %0.2f%%\n", (1 - (o_size / i_size)) * 100);
+        if (encoder.stored == true) {
+            fprintf(stderr, "Input is incompressible, stored as is\n");
+        } else if (encoder.use_rle == true) {
+            fprintf(stderr, "Input was run-length coded first\n");
+        }
+        if (encoder.blocks > 1) {
+            fprintf(stderr, "Split into %lu blocks\n", (unsigned long) encoder.blocks);
+        }
+        if (opts.cache != NULL) {
+            fprintf(stderr, "Tree cache: %lu hits, %lu misses\n", (unsigned long) opts.cache->hits,
+                (unsigned long) opts.cache->misses);
+        }
+        if (encoder.sampled == true && opts.histogram != NULL) {
+            fprintf(stderr, "Histogram was given, at a cost of %ld bytes (%0.3f%%)\n",
+                (long) encoder.sample_loss, 100.0 * encoder.sample_loss / o_size);
+        } else if (encoder.sampled == true) {
+            fprintf(stderr, "Histogram was sampled, at a cost of %ld bytes (%0.3f%%)\n",
+                (long) encoder.sample_loss, 100.0 * encoder.sample_loss / o_size);
+        }
     }
 
+    if (encoder.perf != NULL) {
+        perf_report(encoder.perf, encoder.file_size, stderr);
+        perf_delete(&encoder.perf);
+    }
+    if (opts.cache != NULL) {
+        cache_close(&opts.cache);
+    }
     if (ifd != 0) {
         close(ifd);
     }
@@ -161,6 +345,5 @@ int main(int argc, char **argv) {
         close(ofd);
     }
 
-    delete_tree(&root);
     return 0;
 }
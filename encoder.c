@@ -0,0 +1,1363 @@
+#include "encoder.h"
+#include "cache.h"
+#include "checksum.h"
+#include "header.h"
+#include "huffman.h"
+#include "planner.h"
+#include "small.h"
+#include "wide.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SAMPLE_MIN_BLOCKS 16 // Fewest blocks worth estimating a histogram from.
+
+// Rewind the input to its start, ready for another pass over it.
+//
+// Input parameters:
+// e: Encoder *: Encoder reading the input
+// ifd: int: File descriptor of the file to encode
+// Returns: bool: false if the input cannot be rewound, true otherwise
+static bool rewind_input(Encoder *e, int ifd) {
+    rle_init(&e->rle);
+    e->rle_pos = 0;
+    e->rle_len = 0;
+    e->rle_done = false;
+    e->input_crc = 0;
+    e->file_size = 0;
+    return lseek(ifd, 0, SEEK_SET) == 0;
+}
+
+// Read the next BLOCK of bytes to be coded. When e->use_rle is set,
+// these are the input after run-length coding, which is staged in
+// rle_buf so that every read but the last is still a whole BLOCK. The
+// size and checksum of the input itself are kept in e->file_size and
+// e->input_crc.
+//
+// Input parameters:
+// e: Encoder *: Encoder reading the input
+// ifd: int: File descriptor of the file to encode
+// buf: uint8_t *: Buffer of BLOCK bytes to read into
+// Returns: int: Number of bytes read, 0 at the end of the input
+static int read_input(Encoder *e, int ifd, uint8_t *buf) {
+    uint8_t in[BLOCK];
+    int n;
+
+    if (e->use_rle == false) {
+        n = read_bytes(ifd, buf, BLOCK);
+        e->input_crc = crc32c(e->input_crc, buf, n);
+        e->file_size += n;
+        return n;
+    }
+
+    while (e->rle_len - e->rle_pos < BLOCK && e->rle_done == false) {
+        memmove(e->rle_buf, e->rle_buf + e->rle_pos, e->rle_len - e->rle_pos);
+        e->rle_len -= e->rle_pos;
+        e->rle_pos = 0;
+        if ((n = read_bytes(ifd, in, BLOCK)) == 0) {
+            e->rle_len += rle_finish(&e->rle, e->rle_buf + e->rle_len);
+            e->rle_done = true;
+        } else {
+            e->input_crc = crc32c(e->input_crc, in, n);
+            e->file_size += n;
+            e->rle_len += rle_encode(&e->rle, in, n, e->rle_buf + e->rle_len);
+        }
+    }
+    n = e->rle_len - e->rle_pos < BLOCK ? e->rle_len - e->rle_pos : BLOCK;
+    memcpy(buf, e->rle_buf + e->rle_pos, n);
+    e->rle_pos += n;
+    return n;
+}
+
+// Create the frequency table for the input file. The file is read as
+// bytes, and each byte is used as an index into the histogram. Each time
+// the byte is encountered in the file, the frequency is incremented by 1.
+// To ensure that there are at least 2 nodes in the tree that's created
+// from this histogram, the first and the last frequency is incremented by 1.
+// The checksum of the bytes counted is computed in the same pass.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose histogram is filled in, with the input rewound
+// ifd: int: File descriptor of the file to encode
+// crc: uint32_t *: CRC32C of the bytes counted
+// Returns: void
+void create_histogram(Encoder *e, int ifd, uint32_t *crc) {
+    uint64_t *h = e->histogram;
+    uint8_t buf[BLOCK];
+    int num_bytes_read;
+
+    h[0] += 1;
+    h[ALPHABET - 1] += 1;
+
+    // Read the infile using read_input(). Use the byte value as an index
+    // to the histogram and increment the frequency by 1.
+    while ((num_bytes_read = read_input(e, ifd, buf)) != 0) {
+        for (int i = 0; i < num_bytes_read; i++) {
+            h[buf[i]] += 1;
+        }
+        *crc = crc32c(*crc, buf, num_bytes_read);
+    }
+    return;
+}
+
+// Count the input as 16-bit symbols and build their codes, for a
+// BLOCK_WIDE block. The size and checksum of the input are computed in
+// the same pass.
+//
+// Input parameters:
+// e: Encoder *: Encoder reading the input, with the input rewound
+// wc: WideCoder *: Coder to fill in, with its counts zeroed
+// ifd: int: File descriptor of the file to encode
+// block: BlockHeader *: Filled in with the sizes and checksum of the block
+// table: uint8_t **: Set to the dumped table, which the caller frees
+// table_size: uint32_t *: Set to the size of the dumped table
+// Returns: bool: false if there is no memory to build the codes with, true otherwise
+static bool plan_wide(Encoder *e, WideCoder *wc, int ifd, BlockHeader *block, uint8_t **table, uint32_t *table_size) {
+    uint8_t buf[BLOCK];
+    int num_bytes_read;
+
+    block->raw_size = 0;
+    block->checksum = 0;
+    while ((num_bytes_read = read_input(e, ifd, buf)) != 0) {
+        wide_count(wc, buf, num_bytes_read);
+        block->checksum = crc32c(block->checksum, buf, num_bytes_read);
+        block->raw_size += num_bytes_read;
+    }
+    if (wide_build(wc) == false || (*table = (uint8_t *) malloc(wc->num_used * WIDE_ENTRY_SIZE + 1)) == NULL) {
+        return false;
+    }
+    *table_size = wide_dump_table(wc, *table);
+
+    block->type = BLOCK_WIDE;
+    block->tree_size = 0;
+    block->coded_size = sizeof(*table_size) + *table_size + (wide_coded_bits(wc) + 7) / 8
+                        + (block->raw_size & 1);
+    return true;
+}
+
+// Write the body of a BLOCK_WIDE block planned by plan_wide(). Reads are
+// a whole BLOCK, which is even, till the last one, so symbols never
+// straddle two reads.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to encode with
+// wc: WideCoder *: Coder with its codes built
+// ifd: int: File descriptor of the file to encode, with the input rewound
+// ofd: int: File descriptor to write the block to
+// table: uint8_t *: Dumped table
+// table_size: uint32_t: Size of the dumped table
+// Returns: void
+static void write_wide(Encoder *e, WideCoder *wc, int ifd, int ofd, uint8_t *table, uint32_t table_size) {
+    int num_bytes_read;
+    uint8_t odd = 0;
+    bool has_odd = false;
+    uint8_t size[sizeof(table_size)];
+
+    store_le(size, table_size, sizeof(size));
+    e->write_failed |= write_bytes(ofd, size, sizeof(size)) != sizeof(size);
+    e->write_failed |= write_bytes(ofd, table, (int) table_size) != (int) table_size;
+    bit_writer_init(&e->writer, ofd);
+    while ((num_bytes_read = read_input(e, ifd, e->buf)) != 0) {
+        wide_encode(wc, &e->writer, e->buf, num_bytes_read);
+        has_odd = num_bytes_read & 1;
+        odd = e->buf[num_bytes_read - 1];
+    }
+    flush_codes(&e->writer);
+    e->write_failed |= e->writer.failed;
+    if (has_odd == true) {
+        e->write_failed |= write_bytes(ofd, &odd, 1) != 1;
+    }
+    return;
+}
+
+// Estimate the histogram from a stratified sample of the input, instead
+// of reading all of it. The input is split into one stratum per block
+// to sample, and a BLOCK from a random place in each is read with
+// pread(), which leaves the file offset alone. The sampled counts are
+// scaled up to the size of the input, and every symbol gets a count of
+// at least 1, so that bytes the sample missed still have a code. The
+// random places come from a fixed seed, so that encoding the same file
+// twice gives the same output.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose histogram is filled in
+// ifd: int: File descriptor of the file to encode
+// percent: uint32_t: Percentage of the input's blocks to sample
+// Returns: bool: false if the input is too small to be worth sampling, true otherwise
+static bool sample_histogram(Encoder *e, int ifd, uint32_t percent) {
+    uint64_t nblocks, nsamples, stride, sampled = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    struct stat statbuf;
+    uint8_t buf[BLOCK];
+    RleState rle;
+
+    if (fstat(ifd, &statbuf) != 0 || S_ISREG(statbuf.st_mode) == false) {
+        return false;
+    }
+    nblocks = ((uint64_t) statbuf.st_size + BLOCK - 1) / BLOCK;
+    nsamples = nblocks * percent / 100;
+    if (nsamples < SAMPLE_MIN_BLOCKS || nsamples * 2 > nblocks) {
+        return false;
+    }
+    stride = nblocks / nsamples;
+
+    memset(e->histogram, 0, sizeof(e->histogram));
+    for (uint64_t i = 0; i < nsamples; i++) {
+        uint64_t block;
+        uint8_t *bytes = buf;
+        ssize_t n;
+
+        // xorshift64
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        block = i * stride + seed % stride;
+        if ((n = pread(ifd, buf, BLOCK, (off_t) (block * BLOCK))) <= 0) {
+            continue;
+        }
+        sampled += n;
+
+        // Runs are cut short at the edges of each sample, which is
+        // close enough for an estimate.
+        if (e->use_rle == true) {
+            rle_init(&rle);
+            bytes = e->rle_buf;
+            n = rle_encode(&rle, buf, n, bytes);
+            n += rle_finish(&rle, bytes + n);
+        }
+        for (ssize_t j = 0; j < n; j++) {
+            e->histogram[bytes[j]] += 1;
+        }
+    }
+    if (sampled == 0) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        e->histogram[i] = (uint64_t) ((double) e->histogram[i] * statbuf.st_size / sampled);
+        if (e->histogram[i] == 0) {
+            e->histogram[i] = 1;
+        }
+    }
+    e->file_size = statbuf.st_size;
+    return true;
+}
+
+// Whether a sampled histogram shows tANS coding the input much smaller
+// than Huffman codes would, as with long runs of one byte, which a
+// Huffman code cannot take less than a bit for. tANS needs exact counts,
+// so the input is then counted in full after all. Where it would only
+// save a little, as on most text, the sample is kept.
+//
+// Input parameters:
+// h: uint64_t *: Sampled histogram, scaled to the input
+// backend: uint8_t: ENCODE_AUTO, ENCODE_HUFFMAN or ENCODE_ANS, as the version allows
+// Returns: bool: true if the input should be counted for tANS, false otherwise
+static bool sample_wants_ans(uint64_t h[static ALPHABET], uint8_t backend) {
+    Code table[ALPHABET];
+    uint16_t normalized[ALPHABET];
+    uint64_t total = 0, huffman;
+    uint32_t log;
+    Node nodes[MAX_NODES];
+    Node *root;
+
+    if (backend != ENCODE_AUTO) {
+        return backend == ENCODE_ANS;
+    }
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        total += h[i];
+    }
+    root = build_tree(h, nodes);
+    build_codes(root, table);
+    huffman = (coded_bits(h, table) + 7) / 8;
+    log = ans_normalize(normalized, h, total);
+    return ans_coded_size(normalized, log, h, total) < huffman - huffman / 8;
+}
+
+// Take the histogram from counts given by the caller instead of counting
+// the input, such as the summed counts of every shard of a dataset. The
+// counts need not cover the input, so every byte gets a count of at
+// least 1. They are not scaled to the input, so every input given the
+// same counts is coded with the same tree. As with a sample, the sizes
+// are only filled in after the coding pass, which needs the input to be
+// a regular file.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose histogram is filled in
+// ifd: int: File descriptor of the file to encode
+// hist: const uint64_t *: Counts to build the tree from
+// Returns: bool: false if the input is not a regular file, true otherwise
+static bool given_histogram(Encoder *e, int ifd, const uint64_t hist[static ALPHABET]) {
+    struct stat statbuf;
+
+    if (fstat(ifd, &statbuf) != 0 || S_ISREG(statbuf.st_mode) == false) {
+        return false;
+    }
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        e->histogram[i] = hist[i] != 0 ? hist[i] : 1;
+    }
+    e->file_size = statbuf.st_size;
+    return true;
+}
+
+// Fill in the sizes of a block coded with a sampled histogram, and
+// work out how many bytes the sample cost, by comparing the size it
+// came out at with the size a tree built from the exact counts would
+// have given.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose table was built from the sample
+// exact: uint64_t *: Exact histogram of the bytes coded
+// block: BlockHeader *: Block whose sizes are filled in
+// Returns: int64_t: Bytes lost to the estimate
+static int64_t sample_loss(Encoder *e, uint64_t exact[static ALPHABET], BlockHeader *block) {
+    Code table[ALPHABET];
+    uint32_t hist_size = 0;
+    uint64_t bits;
+    Node nodes[MAX_NODES];
+    Node *root;
+
+    block->raw_size = 0;
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        block->raw_size += exact[i];
+    }
+    block->coded_size = (coded_bits(exact, e->table) + 7) / 8;
+
+    exact[0] += 1;
+    exact[ALPHABET - 1] += 1;
+    root = build_tree(exact, nodes);
+    build_codes(root, table);
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        hist_size += exact[i] != 0;
+    }
+    bits = coded_bits(exact, table) - code_size(&table[0]) - code_size(&table[ALPHABET - 1]);
+    return (int64_t) (block->coded_size + block->tree_size) - (int64_t) ((bits + 7) / 8 + 3 * hist_size - 1);
+}
+
+// Pick the tree to code e->histogram with, and fill in e->table. With a
+// cache, a recently used tree that codes the histogram nearly as well
+// as a new one is reused, which saves building the tree and dumping it,
+// and the block refers to it by id. Otherwise a tree is built. What goes
+// in place of the tree dump is left in tree, and its size in the block.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose histogram is filled in
+// cache: TreeCache *: Trees to reuse, or NULL
+// block: BlockHeader *: Filled in with the block type and tree size
+// tree: uint8_t *: Buffer of MAX_TREE_SIZE bytes for the tree dump or id
+// Returns: void
+static void choose_tree(Encoder *e, TreeCache *cache, BlockHeader *block, uint8_t *tree) {
+    CachedTree *t;
+    Node nodes[MAX_NODES];
+    Node *root;
+
+    perf_enter(e->perf, PERF_TREE);
+    if (cache != NULL && (t = cache_find(cache, e->histogram)) != NULL) {
+        memcpy(e->table, t->table, sizeof(e->table));
+        encode_table_build(&e->codes, e->table);
+        store_le(tree, t->id, sizeof(t->id));
+        block->type = BLOCK_CACHED;
+        block->tree_size = sizeof(t->id);
+        return;
+    }
+
+    // Build a Huffman tree and code table from the histogram
+    root = build_tree(e->histogram, nodes);
+    build_codes(root, e->table);
+    encode_table_build(&e->codes, e->table);
+    block->type = BLOCK_HUFFMAN;
+    block->tree_size = flatten_tree(root, tree);
+    return;
+}
+
+// Code a block with e->ans, reading it from the input again: the whole
+// input for a single block, or the part of it a planned block covers.
+// With an ofd of -1, nothing is written, and only the size is worked out.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose ans is built for the block
+// ifd: int: File descriptor of the file to encode
+// ofd: int: File descriptor to write the coded block to, or -1
+// b: PlannedBlock *: Block planned by the planner, or NULL for the whole input
+// Returns: uint64_t: Size of the coded block
+static uint64_t ans_pass(Encoder *e, int ifd, int ofd, PlannedBlock *b) {
+    uint64_t coded;
+    int n;
+
+    if (b == NULL) {
+        rewind_input(e, ifd);
+        perf_enter(e->perf, PERF_INPUT);
+        while ((n = read_input(e, ifd, e->buf)) != 0) {
+            perf_enter(e->perf, PERF_CODE);
+            ans_encode(&e->ans, e->buf, (uint32_t) n, ofd);
+            perf_enter(e->perf, PERF_INPUT);
+        }
+    } else {
+        lseek(ifd, (off_t) b->offset, SEEK_SET);
+        for (uint64_t remaining = b->size; remaining > 0; remaining -= n) {
+            perf_enter(e->perf, PERF_INPUT);
+            if ((n = read_bytes(ifd, e->buf, remaining < BLOCK ? (int) remaining : BLOCK)) == 0) {
+                break;
+            }
+            perf_enter(e->perf, PERF_CODE);
+            ans_encode(&e->ans, e->buf, (uint32_t) n, ofd);
+        }
+    }
+    perf_enter(e->perf, PERF_CODE);
+    coded = ans_flush(&e->ans, ofd);
+    e->write_failed |= e->ans.failed;
+    return coded;
+}
+
+// Switch a block to tANS if that codes it smaller than the Huffman tree
+// chosen for it, or always with ENCODE_ANS. The size is estimated from
+// the normalized counts first, and only if that comes out smaller is it
+// worked out exactly, by coding the block without writing it, since the
+// block header has to go out first. The table is left in tree.
+//
+// Input parameters:
+// e: Encoder *: Encoder that chose a Huffman tree for the block
+// ifd: int: File descriptor of the file to encode
+// b: PlannedBlock *: Block planned by the planner, or NULL for the whole input
+// hist: const uint64_t *: Histogram of the block, without padding
+// block: BlockHeader *: Block to switch, with its Huffman sizes
+// tree: uint8_t *: Buffer of MAX_TREE_SIZE bytes for the table
+// Returns: void
+static void choose_ans(Encoder *e, int ifd, PlannedBlock *b, const uint64_t hist[static ALPHABET], BlockHeader *block, uint8_t *tree) {
+    uint8_t table[ANS_MAX_TABLE];
+    uint64_t huffman = block->tree_size + block->coded_size, coded;
+    uint32_t table_size;
+
+    if (e->backend == ENCODE_HUFFMAN || block->raw_size == 0) {
+        return;
+    }
+    perf_enter(e->perf, PERF_TREE);
+    ans_encoder_build(&e->ans, hist, block->raw_size);
+    table_size = ans_pack_table(&e->ans, table);
+    if (e->backend == ENCODE_AUTO
+        && table_size + ans_coded_size(e->ans.counts, e->ans.log, hist, block->raw_size) >= huffman) {
+        return;
+    }
+    coded = ans_pass(e, ifd, -1, b);
+    if (e->backend == ENCODE_AUTO && table_size + coded >= huffman) {
+        return;
+    }
+    memcpy(tree, table, table_size);
+    block->type = BLOCK_ANS;
+    block->tree_size = (uint16_t) table_size;
+    block->coded_size = coded;
+    return;
+}
+
+// Write what goes in place of the tree dump, and add a newly built tree
+// to the cache, now that it is known to be used.
+//
+// Input parameters:
+// e: Encoder *: Encoder whose histogram the tree was built for
+// cache: TreeCache *: Trees to reuse, or NULL
+// ofd: int: File descriptor to write to
+// block: BlockHeader *: Header of the block
+// tree: uint8_t *: Tree dump or id from choose_tree()
+// Returns: void
+static void write_tree(Encoder *e, TreeCache *cache, int ofd, BlockHeader *block, uint8_t *tree) {
+    if (cache != NULL && block->type == BLOCK_HUFFMAN) {
+        cache_insert(cache, e->histogram, tree, block->tree_size);
+    }
+    e->write_failed |= write_bytes(ofd, tree, block->tree_size) != block->tree_size;
+    return;
+}
+
+// Write one block planned by the planner, with a tree of its own, or
+// stored if that comes out smaller.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to encode with
+// ifd: int: File descriptor of the file to encode
+// ofd: int: File descriptor to write the block to
+// b: PlannedBlock *: Block to write
+// cache: TreeCache *: Trees to reuse, or NULL
+// out: BlockHeader *: Filled in with the header of the block written
+// Returns: bool: true if the block was stored, false if it was coded
+static bool write_planned(Encoder *e, int ifd, int ofd, PlannedBlock *b, TreeCache *cache, BlockHeader *out) {
+    BlockHeader block = { 0 };
+    uint8_t tree[MAX_TREE_SIZE];
+    uint64_t bits, remaining;
+
+    memcpy(e->histogram, b->histogram, sizeof(e->histogram));
+    e->histogram[0] += 1;
+    e->histogram[ALPHABET - 1] += 1;
+    choose_tree(e, cache, &block, tree);
+    bits = coded_bits(e->histogram, e->table);
+    bits -= code_size(&e->table[0]) + code_size(&e->table[ALPHABET - 1]);
+
+    block.checksum = b->crc;
+    block.raw_size = b->size;
+    block.coded_size = (bits + 7) / 8;
+    choose_ans(e, ifd, b, b->histogram, &block, tree);
+    if (block.coded_size + block.tree_size >= b->size) {
+        block.type = BLOCK_STORED;
+        block.tree_size = 0;
+        block.coded_size = b->size;
+    }
+
+    e->write_failed |= write_block_header(ofd, &block) == false;
+    lseek(ifd, (off_t) b->offset, SEEK_SET);
+    if (block.type == BLOCK_STORED) {
+        perf_enter(e->perf, PERF_OUTPUT);
+        e->write_failed |= copy_bytes(ifd, ofd, b->size) != b->size;
+    } else if (block.type == BLOCK_ANS) {
+        write_tree(e, cache, ofd, &block, tree);
+        ans_pass(e, ifd, ofd, b);
+    } else {
+        write_tree(e, cache, ofd, &block, tree);
+        bit_writer_init(&e->writer, ofd);
+        for (remaining = b->size; remaining > 0;) {
+            int n;
+
+            perf_enter(e->perf, PERF_INPUT);
+            n = read_bytes(ifd, e->buf, remaining < BLOCK ? (int) remaining : BLOCK);
+            if (n == 0) {
+                break;
+            }
+            perf_enter(e->perf, PERF_CODE);
+            encode_block(&e->codes, e->buf, (size_t) n, &e->writer);
+            remaining -= n;
+        }
+        flush_codes(&e->writer);
+        e->write_failed |= e->writer.failed;
+    }
+    *out = block;
+    return block.type == BLOCK_STORED;
+}
+
+// What each compression level sets, from MIN_LEVEL up, which is only
+// the sampling and splitting options. The fast levels estimate the
+// histogram from a sample, so that the input is read in full only once,
+// unless the sample shows tANS saving much, and code it with one tree.
+// Inputs too small to sample are counted, and still become small objects.
+// The middle level counts the histogram exactly, and codes the input with
+// one tree or tANS table. The slow levels split the input into blocks
+// with trees of their own, planned on ever smaller segments, so that the
+// boundaries fall closer to where the content changes. No level reuses
+// trees, which takes a cache given with -c, or uses fixed blocks, which
+// would only add headers to the one-block path. Nor do any use
+// length-limited codes, which byte codes never need: with at most
+// ALPHABET leaves, every code fits in MAX_CODE_SIZE. Order-1 contexts
+// would need a new block type.
+static const struct {
+    uint32_t sample_percent;
+    bool split;
+    uint32_t segment;
+    uint32_t lookahead;
+} levels[MAX_LEVEL - MIN_LEVEL + 1] = {
+    { 1, false, 0, 0 },
+    { 3, false, 0, 0 },
+    { 10, false, 0, 0 },
+    { 25, false, 0, 0 },
+    { 0, false, 0, 0 },
+    { 0, true, 16 * BLOCK, 4 },
+    { 0, true, 8 * BLOCK, 4 },
+    { 0, true, 4 * BLOCK, 4 },
+    { 0, true, BLOCK, 4 },
+};
+
+// Set the options for a compression level, between MIN_LEVEL for the
+// fastest and MAX_LEVEL for the smallest output. Options that a level
+// does not set are left alone.
+//
+// Input parameters:
+// opts: EncodeOptions *: Options to set
+// level: int: Compression level
+// Returns: bool: false if there is no such level, true otherwise
+bool encode_level(EncodeOptions *opts, int level) {
+    if (level < MIN_LEVEL || level > MAX_LEVEL) {
+        return false;
+    }
+    opts->sample_percent = levels[level - MIN_LEVEL].sample_percent;
+    opts->split = levels[level - MIN_LEVEL].split;
+    opts->segment = levels[level - MIN_LEVEL].segment;
+    opts->lookahead = levels[level - MIN_LEVEL].lookahead;
+    return true;
+}
+
+// Set up the header of a new file, in the version asked for. Version 2
+// files get a block index.
+//
+// Input parameters:
+// header: Header *: Header to fill in
+// permissions: uint16_t: Permissions to record in it
+// version: uint8_t: Container version, 0 for HEADER_VERSION
+// Returns: void
+static void new_header(Header *header, uint16_t permissions, uint8_t version) {
+    header_init(header, permissions, 0);
+    if (version != 0) {
+        header->version = version;
+    }
+    if (header->version >= 2) {
+        header->flags |= HEADER_INDEX;
+    }
+    return;
+}
+
+// Fill in the header overhead of a file with at most one block, and the
+// size of the whole encoded file, once est->stored is known.
+//
+// Input parameters:
+// file_size: uint64_t: Size of the input
+// block_size: uint64_t: Size of the coded block, tree or table included
+// version: uint8_t: Container version, 0 for HEADER_VERSION
+// est: Estimate *: Estimate to fill in the overhead and size of
+// Returns: void
+static void estimate_overhead(uint64_t file_size, uint64_t block_size, uint8_t version, Estimate *est) {
+    uint8_t buf[HEADER_MAX_SIZE];
+    Header header;
+
+    new_header(&header, 0, version);
+    est->overhead = pack_header(&header, buf) + TRAILER_SIZE;
+    if ((header.flags & HEADER_INDEX) != 0) {
+        est->overhead += INDEX_COUNT_SIZE + (file_size != 0 ? INDEX_ENTRY_SIZE : 0);
+    }
+    est->out_size = est->overhead;
+    if (file_size != 0) {
+        est->overhead += BLOCK_HEADER_SIZE;
+        est->out_size += BLOCK_HEADER_SIZE;
+        est->out_size += est->stored == true ? file_size : block_size;
+    }
+    return;
+}
+
+// Work out the sizes encode_file() would come to for a histogram, from
+// the code lengths of the tree it would build. A histogram padded as
+// create_histogram() pads it has the padding taken back out of the
+// counts, as encode_file() does. Where backend allows tANS, its size is
+// worked out from the normalized counts, as choose_ans() first does, and
+// used if it is smaller, so that is only close, not exact, and
+// est->approximate says so.
+//
+// Input parameters:
+// h: uint64_t *: Histogram of the bytes to code
+// padded: bool: Whether the first and last counts were padded by one
+// file_size: uint64_t: Size of the input
+// version: uint8_t: Container version, 0 for HEADER_VERSION
+// backend: uint8_t: ENCODE_AUTO, ENCODE_HUFFMAN or ENCODE_ANS
+// est: Estimate *: Filled in with the sizes
+// Returns: void
+static void estimate_histogram(uint64_t h[static ALPHABET], bool padded, uint64_t file_size, uint8_t version, uint8_t backend, Estimate *est) {
+    Code table[ALPHABET];
+    uint64_t counts[ALPHABET];
+    uint16_t normalized[ALPHABET];
+    uint32_t leaves = 0, log;
+    uint64_t bits, block_size;
+    Node nodes[MAX_NODES];
+    Node *root;
+
+    root = build_tree(h, nodes);
+    build_codes(root, table);
+
+    est->raw_size = 0;
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        est->raw_size += h[i];
+        leaves += h[i] != 0;
+    }
+    bits = coded_bits(h, table);
+    if (padded == true) {
+        est->raw_size -= 2;
+        bits -= code_size(&table[0]) + code_size(&table[ALPHABET - 1]);
+    }
+
+    est->entropy = 0;
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        uint64_t count = h[i] - (padded == true && (i == 0 || i == ALPHABET - 1));
+
+        if (count != 0) {
+            est->entropy -= count * log2((double) count / est->raw_size);
+        }
+    }
+    est->entropy /= 8;
+
+    est->ans_size = 0;
+    if (padded == true && (version == 0 || version >= 2) && backend != ENCODE_HUFFMAN
+        && est->raw_size != 0) {
+        memcpy(counts, h, sizeof(counts));
+        counts[0] -= 1;
+        counts[ALPHABET - 1] -= 1;
+        log = ans_normalize(normalized, counts, est->raw_size);
+        est->ans_size = 1 + ALPHABET / 8 + ans_coded_size(normalized, log, counts, est->raw_size);
+        for (uint32_t i = 0; i < ALPHABET; i++) {
+            est->ans_size += 2 * (counts[i] != 0);
+        }
+    }
+
+    // A tree dump is a leaf marker and symbol for each leaf, and one
+    // byte for each interior node.
+    est->coded_size = (bits + 7) / 8;
+    est->tree_size = 3 * leaves - 1;
+    block_size = est->coded_size + est->tree_size;
+    if (est->ans_size != 0 && (backend == ENCODE_ANS || est->ans_size < block_size)) {
+        block_size = est->ans_size;
+    }
+    est->stored = block_size >= file_size;
+    est->approximate = est->ans_size != 0;
+    estimate_overhead(file_size, block_size, version, est);
+    return;
+}
+
+// Estimate what encode_file() would write for a file with -w, from the
+// codes plan_wide() builds for its 16-bit symbols, which are exactly
+// those a BLOCK_WIDE block would be coded with.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to count with, with the input rewound
+// ifd: int: File descriptor of the file to estimate
+// version: uint8_t: Container version, 0 for HEADER_VERSION
+// est: Estimate *: Filled in with the sizes
+// Returns: bool: false if there is no memory to count with, true otherwise
+static bool estimate_wide(Encoder *e, int ifd, uint8_t version, Estimate *est) {
+    WideCoder *wc = (WideCoder *) calloc(1, sizeof(WideCoder));
+    BlockHeader block = { 0 };
+    uint8_t *table = NULL;
+    uint64_t symbols = 0;
+    uint32_t table_size;
+
+    if (wc == NULL || plan_wide(e, wc, ifd, &block, &table, &table_size) == false) {
+        free(wc);
+        return false;
+    }
+    free(table);
+
+    est->raw_size = block.raw_size;
+    est->tree_size = sizeof(table_size) + table_size;
+    est->coded_size = block.coded_size - est->tree_size;
+    est->ans_size = 0;
+    est->entropy = 0;
+    for (uint32_t i = 0; i < wc->num_used; i++) {
+        symbols += wc->counts[wc->used[i]];
+    }
+    for (uint32_t i = 0; i < wc->num_used; i++) {
+        uint64_t count = wc->counts[wc->used[i]];
+
+        est->entropy -= count * log2((double) count / symbols);
+    }
+    est->entropy = est->entropy / 8 + (block.raw_size & 1);
+    est->stored = block.coded_size >= e->file_size;
+    est->approximate = false;
+    estimate_overhead(e->file_size, block.coded_size, version, est);
+    free(wc);
+    return true;
+}
+
+// Whether encode_file() codes an input as a small object: a regular file
+// of up to SMALL_MAX bytes, with default options but for the level.
+//
+// Input parameters:
+// ifd: int: File descriptor of the file to encode
+// opts: EncodeOptions *: How to encode the file
+// Returns: bool: true if the input is coded as a small object
+static bool use_small(int ifd, EncodeOptions *opts) {
+    struct stat statbuf;
+
+    return opts->version == 0 && opts->rle == false && opts->wide == false && opts->cache == NULL
+        && opts->backend != ENCODE_ANS && opts->histogram == NULL && fstat(ifd, &statbuf) == 0
+        && S_ISREG(statbuf.st_mode) == true && statbuf.st_size <= SMALL_MAX;
+}
+
+// Replace the sizes worked out by estimate_histogram() with those of a
+// small object, for the same padded histogram.
+//
+// Input parameters:
+// h: uint64_t *: Histogram of the bytes, padded as create_histogram() pads it
+// est: Estimate *: Estimate whose sizes to replace
+// Returns: void
+static void estimate_small(uint64_t h[static ALPHABET], Estimate *est) {
+    uint64_t counts[ALPHABET];
+    uint32_t coded_size;
+    uint8_t kind;
+
+    memcpy(counts, h, sizeof(counts));
+    counts[0] -= 1;
+    counts[ALPHABET - 1] -= 1;
+    est->out_size = small_estimate(counts, &kind, &est->tree_size, &coded_size);
+    est->coded_size = coded_size;
+    est->ans_size = 0;
+    est->overhead = SMALL_HEADER_SIZE + TRAILER_SIZE;
+    est->stored = kind == SMALL_STORED && est->raw_size != 0;
+    est->approximate = false;
+    return;
+}
+
+// Estimate what encode_file() would write for a buffer with default
+// options, without coding it, as a small object if it is as small as
+// one. Nothing is allocated but the tree, so this can be called over
+// many buffers in a row.
+//
+// Input parameters:
+// buf: const uint8_t *: Bytes to estimate
+// n: size_t: Number of bytes
+// est: Estimate *: Filled in with the sizes
+// Returns: void
+void estimate_buffer(const uint8_t *buf, size_t n, Estimate *est) {
+    uint64_t h[ALPHABET] = { 0 };
+
+    h[0] += 1;
+    h[ALPHABET - 1] += 1;
+    for (size_t i = 0; i < n; i++) {
+        h[buf[i]] += 1;
+    }
+    estimate_histogram(h, true, n, 0, ENCODE_AUTO, est);
+    if (n <= SMALL_MAX) {
+        estimate_small(h, est);
+    }
+    return;
+}
+
+// Estimate what encode_file() would write for a file, with one tree
+// and the run-length coding, sampling, -w, backend and version in opts,
+// without coding it. The input is read once, or only sampled, and
+// nothing is written. It need not be a regular file, unless it is to be
+// sampled. Splitting is not estimated, so opts->split must be false.
+//
+// The sizes are exact but where est->approximate or e->sampled say
+// otherwise: a sampled histogram, tANS, whose size is only worked out
+// from its normalized counts, and a tree cache, which may have a tree
+// to reuse.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to count with
+// ifd: int: File descriptor of the file to estimate
+// opts: EncodeOptions *: How the file would be encoded
+// est: Estimate *: Filled in with the sizes
+// Returns: bool: false if there is no memory to count with, true otherwise
+bool estimate_file(Encoder *e, int ifd, EncodeOptions *opts, Estimate *est) {
+    uint8_t backend = opts->version == 1 || (opts->cache != NULL && opts->backend == ENCODE_AUTO)
+        ? ENCODE_HUFFMAN : opts->backend;
+    uint32_t crc = 0;
+    bool ok = true;
+
+    e->use_rle = opts->rle;
+    e->sampled = false;
+    rewind_input(e, ifd);
+
+    perf_enter(e->perf, PERF_HISTOGRAM);
+    if (opts->wide == true) {
+        ok = estimate_wide(e, ifd, opts->version, est);
+        perf_stop(e->perf);
+        return ok;
+    }
+    if (opts->sample_percent != 0 && sample_histogram(e, ifd, opts->sample_percent) == true) {
+        e->sampled = sample_wants_ans(e->histogram, backend) == false;
+    }
+    if (e->sampled == false) {
+        memset(e->histogram, 0, sizeof(e->histogram));
+        create_histogram(e, ifd, &crc);
+    }
+    perf_enter(e->perf, PERF_TREE);
+    estimate_histogram(e->histogram, e->sampled == false, e->file_size, opts->version, backend, est);
+    if (e->sampled == false && e->use_rle == false && e->file_size <= SMALL_MAX
+        && use_small(ifd, opts) == true) {
+        estimate_small(e->histogram, est);
+    }
+    est->approximate |= opts->cache != NULL;
+    perf_stop(e->perf);
+    return ok;
+}
+
+// Note where a block that was just written went, for the block index,
+// and move past it. If the index cannot grow, e->no_memory is set, and
+// the index is left as it was.
+//
+// Input parameters:
+// e: Encoder *: Encoder that wrote the block
+// block: BlockHeader *: Header of the block, with its final sizes
+// Returns: bool: false if there is no memory to grow the index, true otherwise
+static bool index_block(Encoder *e, BlockHeader *block) {
+    IndexEntry *grown;
+
+    if (e->blocks == e->index_size) {
+        uint32_t size = e->index_size == 0 ? 16 : 2 * e->index_size;
+
+        if ((grown = (IndexEntry *) realloc(e->index, size * sizeof(IndexEntry))) == NULL) {
+            e->no_memory = true;
+            return false;
+        }
+        e->index = grown;
+        e->index_size = size;
+    }
+    e->index[e->blocks].offset = e->offset;
+    e->index[e->blocks].position = e->position;
+    e->offset += BLOCK_HEADER_SIZE + block->tree_size + block->coded_size;
+    e->position += block->raw_size;
+    e->blocks += 1;
+    return true;
+}
+
+// Write the header of a new file, or when appending, nothing, since the
+// new blocks go where the index was, and the header is written again at
+// the end.
+//
+// Input parameters:
+// e: Encoder *: Encoder writing the file
+// ofd: int: File descriptor to write the encoded file to
+// header: Header *: Header to write
+// append: bool: Whether blocks are being added to an existing file
+// Returns: uint32_t: Size of the header written
+static uint32_t begin_file(Encoder *e, int ofd, Header *header, bool append) {
+    if (append == true) {
+        return 0;
+    }
+    e->offset = write_header(ofd, header);
+    e->write_failed |= e->offset == 0;
+    return (uint32_t) e->offset;
+}
+
+// End a file after its last block, with the block index if the header
+// asks for one, and the trailer.
+//
+// Input parameters:
+// e: Encoder *: Encoder that wrote the blocks
+// ofd: int: File descriptor to write the encoded file to
+// header: Header *: Header of the file
+// crc: uint32_t: CRC32C of the whole input
+// Returns: void
+static void finish_file(Encoder *e, int ofd, Header *header, uint32_t crc) {
+    Trailer trailer;
+
+    e->out_size = e->offset + TRAILER_SIZE;
+    if ((header->flags & HEADER_INDEX) != 0) {
+        e->write_failed |= write_index(ofd, e->index, (uint32_t) e->blocks) == false;
+        e->out_size += e->blocks * INDEX_ENTRY_SIZE + INDEX_COUNT_SIZE;
+    }
+    trailer.checksum = crc;
+    e->write_failed |= write_trailer(ofd, &trailer) == false;
+    return;
+}
+
+// Encode ifd as a sequence of blocks, split where the content changes
+// enough that separate trees pay for themselves. The planner reads
+// ahead in a thread of its own, so the blocks are coded as soon as each
+// is planned. The file size is taken from fstat(), since the header
+// goes out before the input is read.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to encode with
+// ifd: int: File descriptor of the file to encode
+// ofd: int: File descriptor to write the blocks to
+// header: Header *: Header of the file, whose size the input is added to
+// append: bool: Whether the blocks are added to an existing file
+// opts: EncodeOptions *: How to encode the file
+// Returns: bool: false if the input is not a regular file or memory runs out, true otherwise
+static bool encode_split(Encoder *e, int ifd, int ofd, Header *header, bool append, EncodeOptions *opts) {
+    struct stat statbuf;
+    PlannedBlock *b;
+    Planner *p;
+
+    if (fstat(ifd, &statbuf) != 0 || S_ISREG(statbuf.st_mode) == false) {
+        return false;
+    }
+    if ((b = (PlannedBlock *) malloc(sizeof(PlannedBlock))) == NULL
+        || (p = planner_create(ifd, opts->segment != 0 ? opts->segment : PLAN_SEGMENT,
+                opts->lookahead != 0 ? opts->lookahead : PLAN_LOOKAHEAD))
+            == NULL) {
+        e->no_memory = true;
+        free(b);
+        return false;
+    }
+    header->file_size += statbuf.st_size;
+    if (e->backend != ENCODE_HUFFMAN) {
+        header->flags |= HEADER_ANS;
+    }
+
+    e->file_size = 0;
+    e->stored = true;
+    begin_file(e, ofd, header, append);
+    // Once the index cannot grow, the rest of the blocks are only taken,
+    // so that the planner can finish.
+    while (planner_next(p, b) == true) {
+        BlockHeader block;
+
+        if (e->no_memory == true) {
+            continue;
+        }
+        e->stored &= write_planned(e, ifd, ofd, b, opts->cache, &block);
+        e->file_size += b->size;
+        index_block(e, &block);
+    }
+    perf_stop(e->perf);
+    e->input_crc = planner_crc(p);
+    planner_delete(&p);
+    free(b);
+    return e->no_memory == false;
+}
+
+// Encode the whole of ifd as blocks, after the header of a new file or
+// in place of the index of an existing one. The input is read twice,
+// once to build the histogram and once to code it, so it must be
+// seekable, and is read from its start. With opts->rle, the blocks hold
+// the input after run-length coding, and the header is flagged with
+// HEADER_RLE, unless the input ends up stored as is.
+//
+// With opts->split, the input is split into blocks with trees of their
+// own by encode_split(). That only applies to plain byte coding.
+//
+// With opts->sample_percent, the histogram is estimated from a sample
+// of the input, so that it is only read in full once. The sizes and
+// checksums are then only known once the input is coded, so the header
+// and block header are written again afterwards, which needs ofd to be
+// seekable too. Otherwise, the histogram is counted in full. The bytes
+// lost to the estimate are left in e->sample_loss. opts->histogram is
+// used the same way, in place of a sample, and takes precedence.
+//
+// Byte blocks are coded with tANS instead of Huffman codes where that
+// comes out smaller, as opts->backend allows. This needs the exact
+// counts, so where a sample shows tANS saving much, the input is counted
+// in full after all, and otherwise tANS is not tried on a sampled or
+// given histogram. It needs version 2, whose header can flag it. With a
+// tree cache, only Huffman trees can be reused, so tANS is then only
+// used if asked for.
+//
+// The CRC32C of the input is left in e->input_crc, for the trailer.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to encode with
+// ifd: int: File descriptor of the file to encode
+// ofd: int: File descriptor to write the blocks to
+// header: Header *: Header of the file, whose size the input is added to
+// append: bool: Whether the blocks are added to an existing file
+// opts: EncodeOptions *: How to encode the file
+// Returns: bool: false if the input cannot be rewound or memory runs out, true otherwise
+static bool encode_blocks(Encoder *e, int ifd, int ofd, Header *header, bool append, EncodeOptions *opts) {
+    uint8_t tree[MAX_TREE_SIZE];
+    WideCoder *wc = NULL;
+    uint8_t *table = NULL;
+    uint32_t table_size = 0;
+    BlockHeader block = { 0 };
+    int num_bytes_read;
+    uint64_t file_size, raw_size, bits;
+    uint32_t crc = 0;
+    uint32_t header_size;
+    uint8_t buf[HEADER_MAX_SIZE];
+    off_t start = -1;
+
+    e->use_rle = opts->rle;
+    e->sampled = false;
+    e->sample_loss = 0;
+    e->backend = header->version >= 2 ? opts->backend : ENCODE_HUFFMAN;
+    if (opts->cache != NULL && e->backend == ENCODE_AUTO) {
+        e->backend = ENCODE_HUFFMAN;
+    }
+    if (opts->split == true && opts->wide == false && opts->rle == false
+        && opts->sample_percent == 0 && opts->histogram == NULL) {
+        return encode_split(e, ifd, ofd, header, append, opts);
+    }
+    if (rewind_input(e, ifd) == false) {
+        return false;
+    }
+
+    perf_enter(e->perf, PERF_HISTOGRAM);
+    if (opts->wide == true) {
+        if ((wc = (WideCoder *) calloc(1, sizeof(WideCoder))) == NULL
+            || plan_wide(e, wc, ifd, &block, &table, &table_size) == false) {
+            e->no_memory = true;
+            free(wc);
+            return false;
+        }
+    } else {
+        // Create a frequency table (histogram) for each symbol
+        // in the input file, or estimate it or take the one given if
+        // asked to.
+        if (opts->histogram != NULL && (start = lseek(ofd, 0, SEEK_CUR)) != -1) {
+            e->sampled = given_histogram(e, ifd, opts->histogram);
+        } else if (opts->sample_percent != 0 && (start = lseek(ofd, 0, SEEK_CUR)) != -1
+            && sample_histogram(e, ifd, opts->sample_percent) == true) {
+            e->sampled = sample_wants_ans(e->histogram, e->backend) == false;
+        }
+        if (e->sampled == false) {
+            memset(e->histogram, 0, sizeof(e->histogram));
+            create_histogram(e, ifd, &crc);
+        }
+
+        choose_tree(e, opts->cache, &block, tree);
+
+        // The padding added by create_histogram() is not part of the
+        // input, so take it back out of the size and the coded bits.
+        // A sampled histogram has no padding, and its sizes are only
+        // estimates.
+        raw_size = 0;
+        for (uint32_t i = 0; i < ALPHABET; i++) {
+            raw_size += e->histogram[i];
+        }
+        bits = coded_bits(e->histogram, e->table);
+        if (e->sampled == false) {
+            raw_size -= 2;
+            bits -= code_size(&e->table[0]) + code_size(&e->table[ALPHABET - 1]);
+        } else if (opts->histogram != NULL && raw_size != 0) {
+            // Given counts are of more than the input, so scale the
+            // coded size down to it.
+            bits = (uint64_t) ((double) bits * e->file_size / raw_size);
+            raw_size = e->file_size;
+        }
+
+        block.checksum = crc;
+        block.raw_size = raw_size;
+        block.coded_size = (bits + 7) / 8;
+        if (e->sampled == false) {
+            uint64_t counts[ALPHABET];
+
+            memcpy(counts, e->histogram, sizeof(counts));
+            counts[0] -= 1;
+            counts[ALPHABET - 1] -= 1;
+            choose_ans(e, ifd, NULL, counts, &block, tree);
+        }
+    }
+    file_size = e->file_size;
+    crc = e->input_crc;
+    header->file_size += file_size;
+
+    // If the coded bits and the tree dump don't come out smaller than
+    // the input (e.g. already compressed data), store the input as is.
+    // A stored block always holds the input itself.
+    if (block.coded_size + block.tree_size >= file_size) {
+        block.type = BLOCK_STORED;
+        block.tree_size = 0;
+        block.raw_size = file_size;
+        block.coded_size = file_size;
+        block.checksum = crc;
+        e->use_rle = false;
+    }
+    if (e->use_rle == true) {
+        header->flags |= HEADER_RLE;
+    }
+    if (block.type == BLOCK_WIDE) {
+        header->flags |= HEADER_WIDE;
+    }
+    if (block.type == BLOCK_ANS) {
+        header->flags |= HEADER_ANS;
+    }
+
+    // An empty file has no blocks at all, only the header and trailer.
+    header_size = begin_file(e, ofd, header, append);
+    if (file_size != 0) {
+        e->write_failed |= write_block_header(ofd, &block) == false;
+        rewind_input(e, ifd);
+        if (block.type == BLOCK_STORED && e->sampled == true) {
+            // The checksum is still to be computed, so the input has to
+            // pass through user space after all.
+            perf_enter(e->perf, PERF_OUTPUT);
+            while ((num_bytes_read = read_input(e, ifd, e->buf)) != 0) {
+                e->write_failed |= write_bytes(ofd, e->buf, num_bytes_read) != num_bytes_read;
+            }
+            block.raw_size = block.coded_size = e->file_size;
+            block.checksum = e->input_crc;
+        } else if (block.type == BLOCK_STORED) {
+            perf_enter(e->perf, PERF_OUTPUT);
+            e->write_failed |= copy_bytes(ifd, ofd, file_size) != file_size;
+        } else if (block.type == BLOCK_WIDE) {
+            perf_enter(e->perf, PERF_CODE);
+            write_wide(e, wc, ifd, ofd, table, table_size);
+        } else if (block.type == BLOCK_ANS) {
+            write_tree(e, opts->cache, ofd, &block, tree);
+            ans_pass(e, ifd, ofd, NULL);
+        } else {
+            uint64_t exact[ALPHABET] = { 0 };
+            uint32_t block_crc = 0;
+
+            write_tree(e, opts->cache, ofd, &block, tree);
+            bit_writer_init(&e->writer, ofd);
+            perf_enter(e->perf, PERF_INPUT);
+            while ((num_bytes_read = read_input(e, ifd, e->buf)) != 0) {
+                perf_enter(e->perf, PERF_CODE);
+                encode_block(&e->codes, e->buf, (size_t) num_bytes_read, &e->writer);
+                for (int i = 0; e->sampled == true && i < num_bytes_read; i++) {
+                    exact[e->buf[i]] += 1;
+                }
+                block_crc = crc32c(block_crc, e->buf, num_bytes_read);
+                perf_enter(e->perf, PERF_INPUT);
+            }
+            perf_enter(e->perf, PERF_CODE);
+            flush_codes(&e->writer);
+            e->write_failed |= e->writer.failed;
+            if (e->sampled == true) {
+                e->sample_loss = sample_loss(e, exact, &block);
+                block.checksum = block_crc;
+            }
+        }
+    }
+    perf_stop(e->perf);
+    if (e->sampled == true) {
+        // Now that the input has been read, fill in what the sample
+        // could only estimate.
+        header->file_size += e->file_size - file_size;
+        file_size = e->file_size;
+        crc = e->input_crc;
+        if (append == false) {
+            e->write_failed |= pwrite(ofd, buf, pack_header(header, buf), start) != (ssize_t) header_size;
+        }
+        if (file_size != 0) {
+            pack_block_header(&block, buf);
+            e->write_failed |= pwrite(ofd, buf, BLOCK_HEADER_SIZE, start + header_size) != BLOCK_HEADER_SIZE;
+        }
+    }
+    if (file_size != 0 && index_block(e, &block) == false) {
+        free(wc);
+        free(table);
+        return false;
+    }
+
+    e->file_size = file_size;
+    e->input_crc = crc;
+    e->stored = block.type == BLOCK_STORED;
+    free(wc);
+    free(table);
+    return true;
+}
+
+// Encode a small input as a small object, read, coded and written in one
+// go each. Nothing is allocated, and no tree is built.
+//
+// Input parameters:
+// e: Encoder *: Encoder to leave the sizes and checksum in
+// ifd: int: File descriptor of the file to encode
+// ofd: int: File descriptor to write the small object to
+// permissions: uint16_t: Permissions to record in the header
+// Returns: bool: false if the input has grown past SMALL_MAX, true otherwise
+static bool encode_small(Encoder *e, int ifd, int ofd, uint16_t permissions) {
+    uint8_t in[SMALL_MAX + 1], out[SMALL_MAX_SIZE];
+    uint32_t size;
+    int n;
+
+    perf_enter(e->perf, PERF_INPUT);
+    if ((n = read_bytes(ifd, in, sizeof(in))) > SMALL_MAX) {
+        return false;
+    }
+    perf_enter(e->perf, PERF_CODE);
+    size = small_encode(in, (uint32_t) n, permissions, out);
+    perf_enter(e->perf, PERF_OUTPUT);
+    e->write_failed |= write_bytes(ofd, out, (int) size) != (int) size;
+    perf_stop(e->perf);
+
+    e->file_size = (uint64_t) n;
+    e->out_size = size;
+    e->stored = out[8] == SMALL_STORED && n != 0;
+    e->use_rle = false;
+    e->sampled = false;
+    e->sample_loss = 0;
+    e->blocks = 1;
+    e->input_crc = (uint32_t) load_le(out + size - TRAILER_SIZE, TRAILER_SIZE);
+    return true;
+}
+
+// Encode the whole of ifd into ofd. The header is written in version
+// opts->version, or HEADER_VERSION if that is 0. See encode_blocks() for
+// how the input is coded. An input small enough, with default options,
+// is written as a small object instead, when opts->version is 0. If it
+// fails for want of memory, e->no_memory says so, and if a write to ofd
+// comes up short, e->write_failed does.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to encode with
+// ifd: int: File descriptor of the file to encode
+// ofd: int: File descriptor to write the encoded file to
+// permissions: uint16_t: Permissions to record in the header
+// opts: EncodeOptions *: How to encode the file
+// Returns: bool: false if the input cannot be rewound, memory runs out or a write fails, true otherwise
+bool encode_file(Encoder *e, int ifd, int ofd, uint16_t permissions, EncodeOptions *opts) {
+    Header header;
+
+    e->no_memory = false;
+    e->write_failed = false;
+    if (use_small(ifd, opts) == true && encode_small(e, ifd, ofd, permissions) == true) {
+        return e->write_failed == false;
+    }
+    new_header(&header, permissions, opts->version);
+    e->blocks = 0;
+    e->position = 0;
+    if (encode_blocks(e, ifd, ofd, &header, false, opts) == false) {
+        return false;
+    }
+    finish_file(e, ofd, &header, e->input_crc);
+    return e->write_failed == false;
+}
+
+// Add the whole of ifd to the end of an encoded file, as new blocks with
+// trees of their own, without decoding or even reading the blocks that
+// are there. The file's block index is read from its end, and the new
+// blocks are written over it, followed by the index with the new blocks
+// added, and a trailer whose checksum is worked out from the old one and
+// that of the new input. Then the header is written again, with the
+// file size and flags updated. The cost is that of encoding ifd alone.
+//
+// The file must have a block index, and so be version 2 or later. Run-
+// length coding carries state across blocks, so blocks cannot be added
+// to a file with HEADER_RLE, and opts->rle cannot be asked for. The other
+// options apply to the new blocks, but opts->version does not.
+//
+// The old index and trailer, and the header, are kept in memory till the
+// new ones are written, so that if anything fails on the way, the file
+// is cut back and put back as it was.
+//
+// Input parameters:
+// e: Encoder *: Scratch space to encode with
+// ifd: int: File descriptor of the file to add
+// ofd: int: File descriptor of the encoded file, open for reading and writing
+// opts: EncodeOptions *: How to encode the new blocks
+// Returns: bool: false if ofd cannot be added to, ifd cannot be rewound, memory runs out or a write fails, true otherwise
+bool encode_append(Encoder *e, int ifd, int ofd, EncodeOptions *opts) {
+    Header header;
+    Trailer trailer;
+    uint8_t buf[HEADER_MAX_SIZE], old_header[HEADER_MAX_SIZE];
+    uint32_t count, header_size;
+    uint64_t old_size, tail_size;
+    uint8_t *tail;
+    struct stat statbuf;
+    int64_t end;
+
+    e->no_memory = false;
+    e->write_failed = false;
+    if (opts->rle == true || lseek(ofd, 0, SEEK_SET) != 0 || read_header(ofd, &header) == false
+        || (header.flags & HEADER_INDEX) == 0 || (header.flags & HEADER_RLE) != 0
+        || lseek(ofd, 0, SEEK_CUR) != (off_t) pack_header(&header, buf)) {
+        return false;
+    }
+    free(e->index);
+    end = load_index(ofd, &e->index, &count, &trailer);
+    e->index_size = e->index != NULL ? count + 1 : 0;
+    header_size = pack_header(&header, old_header);
+    if (end < (int64_t) header_size || fstat(ofd, &statbuf) != 0 || statbuf.st_size < end) {
+        return false;
+    }
+    tail_size = (uint64_t) (statbuf.st_size - end);
+    if ((tail = (uint8_t *) malloc(tail_size)) == NULL) {
+        e->no_memory = true;
+        return false;
+    }
+    if (pread(ofd, tail, tail_size, end) != (ssize_t) tail_size) {
+        free(tail);
+        return false;
+    }
+    e->blocks = count;
+    e->offset = (uint64_t) end;
+    e->position = old_size = header.file_size;
+
+    lseek(ofd, end, SEEK_SET);
+    if (encode_blocks(e, ifd, ofd, &header, true, opts) == true) {
+        finish_file(e, ofd, &header, crc32c_combine(trailer.checksum, e->input_crc, header.file_size - old_size));
+        if (e->write_failed == false) {
+            e->write_failed = pwrite(ofd, buf, pack_header(&header, buf), 0) != (ssize_t) header_size;
+        }
+        if (e->write_failed == false) {
+            free(tail);
+            return true;
+        }
+    }
+
+    // Put the file back as it was. Cutting it back first frees the room
+    // the old index and trailer need.
+    if (ftruncate(ofd, end) == 0) {
+        pwrite(ofd, tail, tail_size, end);
+        pwrite(ofd, old_header, header_size, 0);
+    }
+    free(tail);
+    return false;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "ans.h"
+#include "bulk.h"
+#include "cache.h"
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "io.h"
+#include "perf.h"
+#include "rle.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Scratch space for encoding one file at a time. An Encoder can be reused
+// for any number of files, and each thread needs its own.
+typedef struct {
+    uint64_t histogram[ALPHABET];
+    Code table[ALPHABET];
+    EncodeTable codes; // table flattened for encode_block().
+    BitWriter writer;
+    uint8_t buf[BLOCK];
+    uint64_t file_size; // Size of the last file encoded.
+    uint64_t out_size; // Size of its encoded output.
+    bool stored; // Whether it was incompressible, and stored as is.
+    bool use_rle; // Whether the input is run-length coded on the way in.
+    RleState rle;
+    uint8_t rle_buf[3 * BLOCK + 1];
+    int rle_pos, rle_len;
+    bool rle_done;
+    uint32_t input_crc; // CRC32C of the input read so far.
+    bool sampled; // Whether the histogram was estimated from a sample, or given.
+    int64_t sample_loss; // Bytes the estimate cost over an exact histogram.
+    bool no_memory; // Whether encoding failed for want of memory.
+    bool write_failed; // Whether a write to the output came up short.
+    uint64_t blocks; // Number of blocks written.
+    IndexEntry *index; // Where each block went, for the block index.
+    uint32_t index_size; // Room in index, in entries.
+    uint64_t offset; // Where the next block goes in the output.
+    uint64_t position; // Where its bytes start in the bytes coded.
+    uint8_t backend; // Entropy coders to pick from for the blocks of this file.
+    AnsEncoder ans;
+    PerfCounters *perf; // Counters to attribute to each stage, or NULL.
+} Encoder;
+
+#define ENCODE_AUTO    0 // Code each block with whichever coder makes it smaller.
+#define ENCODE_HUFFMAN 1 // Code every block with a Huffman tree.
+#define ENCODE_ANS     2 // Code every block with tANS.
+
+// Choices about how a file is encoded. All zero gives the defaults.
+typedef struct {
+    bool wide; // Code the input as 16-bit symbols instead of bytes.
+    bool rle; // Run-length code the input before coding it.
+    uint32_t sample_percent; // Estimate the histogram from this much of the input.
+    bool split; // Split the input into blocks where its content changes.
+    uint32_t segment; // Granularity of the split, 0 for PLAN_SEGMENT.
+    uint32_t lookahead; // Segments the split looks ahead, 0 for PLAN_LOOKAHEAD.
+    TreeCache *cache; // Trees to reuse from earlier files, or NULL.
+    uint8_t version; // Container version to write, 0 for HEADER_VERSION.
+    uint8_t backend; // ENCODE_AUTO, ENCODE_HUFFMAN or ENCODE_ANS.
+    const uint64_t *histogram; // Byte counts to build the tree from, or NULL to count the input.
+} EncodeOptions;
+
+// What encode_file() would write for an input coded as one block,
+// worked out from its histogram without coding it.
+typedef struct {
+    uint64_t raw_size; // Bytes to code, after run-length coding if any.
+    uint64_t coded_size; // Bytes of Huffman-coded data.
+    double entropy; // Shannon entropy bound on coded_size, in bytes.
+    uint32_t tree_size; // Bytes of the tree dump.
+    uint64_t ans_size; // Bytes of the tANS table and coded data, 0 if not tried.
+    uint32_t overhead; // Bytes of the header, block header and trailer.
+    uint64_t out_size; // Bytes of the whole encoded file.
+    bool stored; // Whether the input would be stored as is.
+    bool approximate; // Whether the sizes are close rather than exact.
+} Estimate;
+
+#define MIN_LEVEL 1 // Fastest compression level.
+#define MAX_LEVEL 9 // Smallest compression level.
+
+void create_histogram(Encoder *e, int ifd, uint32_t *crc);
+
+void estimate_buffer(const uint8_t *buf, size_t n, Estimate *est);
+
+bool estimate_file(Encoder *e, int ifd, EncodeOptions *opts, Estimate *est);
+
+bool encode_level(EncodeOptions *opts, int level);
+
+bool encode_file(Encoder *e, int ifd, int ofd, uint16_t permissions, EncodeOptions *opts);
+
+bool encode_append(Encoder *e, int ifd, int ofd, EncodeOptions *opts);
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include "fdpass.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define MAX_FDS 2 // Most descriptors sent with a single message.
+
+// Send a fixed size message over a Unix domain socket, along with up to
+// MAX_FDS file descriptors as SCM_RIGHTS ancillary data.
+//
+// Input parameters:
+// sock: int: Connected Unix domain socket
+// buf: void *: Message to send
+// len: size_t: Size of the message
+// fds: int *: Descriptors to pass along
+// nfds: int: Number of descriptors in fds
+// Returns: bool: false if the message could not be sent whole, true otherwise
+bool send_fds(int sock, void *buf, size_t len, int *fds, int nfds) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+
+    if (nfds > MAX_FDS) {
+        return false;
+    }
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) len;
+}
+
+// Receive a fixed size message sent by send_fds(), and any descriptors
+// that came with it.
+//
+// Input parameters:
+// sock: int: Connected Unix domain socket
+// buf: void *: Filled in with the message
+// len: size_t: Size of the message
+// fds: int *: Filled in with up to MAX_FDS received descriptors
+// nfds: int *: Set to the number of descriptors received
+// Returns: bool: false on end of connection or a short message, true otherwise
+bool recv_fds(int sock, void *buf, size_t len, int *fds, int *nfds) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    *nfds = 0;
+
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    for (cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (fds != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+        }
+    }
+    return n == (ssize_t) len;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool send_fds(int sock, void *buf, size_t len, int *fds, int nfds);
+
+bool recv_fds(int sock, void *buf, size_t len, int *fds, int *nfds);
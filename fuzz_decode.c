@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include "decoder.h"
+#include "header.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static Decoder decoder;
+
+// libFuzzer entry point. The input is treated as a whole encoded file:
+// it is placed in a memory backed file, and decoded in --verify mode so
+// that nothing is written. Any input must either decode or be rejected,
+// without crashing, leaking or hanging.
+//
+// Input parameters:
+// data: const uint8_t *: Encoded file produced by the fuzzer
+// size: size_t: Size of data
+// Returns: int: Always 0
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    Header header;
+    int fd = memfd_create("fuzz_decode", 0);
+
+    if (fd == -1) {
+        return 0;
+    }
+    if (write(fd, data, size) == (ssize_t) size && lseek(fd, 0, SEEK_SET) == 0) {
+        if (read_header(fd, &header)) {
+            decode_file(&decoder, fd, -1, &header);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+// Without libFuzzer (e.g. when building with gcc), run the harness once
+// over each file named on the command line, to replay a crashing input.
+//
+// Input parameters:
+// argc: int: Number of input arguments
+// argv: char **: The input files
+// Returns: int: 0 in case of success, non-zero for failure
+int main(int argc, char **argv) {
+    static uint8_t buf[1 << 20];
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        size_t n;
+
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        n = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(buf, n);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,383 @@
+#include "header.h"
+#include "defines.h"
+#include "io.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Set up the header of a file to be encoded, in the default version,
+// with no flags.
+//
+// Input parameters:
+// header: Header *: Header to fill in
+// permissions: uint16_t: File mode of the input
+// file_size: uint64_t: Size of the input
+// Returns: void
+void header_init(Header *header, uint16_t permissions, uint64_t file_size) {
+    memset(header, 0, sizeof(Header));
+    header->version = HEADER_VERSION;
+    header->permissions = permissions & HEADER_PERMISSIONS;
+    header->file_size = file_size;
+    header->checksum = CHECKSUM_CRC32C;
+    header->tree_format = TREE_POSTORDER;
+    return;
+}
+
+// Add a TLV with a one-byte value to a header being packed.
+//
+// Input parameters:
+// buf: uint8_t *: Where the TLV goes
+// type: uint8_t: Type of the TLV
+// value: uint8_t: Its value
+// Returns: uint32_t: Number of bytes the TLV takes
+static uint32_t pack_tlv(uint8_t *buf, uint8_t type, uint8_t value) {
+    buf[0] = type;
+    store_le(buf + 1, 1, 2);
+    buf[3] = value;
+    return 4;
+}
+
+// Lay a header out as it goes in the file, in the layout of its version.
+// Version 1 has no room for the flags but the two it had, and no TLVs.
+//
+// Input parameters:
+// header: Header *: Header to pack
+// buf: uint8_t []: Buffer of HEADER_MAX_SIZE bytes for the packed header
+// Returns: uint32_t: Size of the packed header
+uint32_t pack_header(Header *header, uint8_t buf[static HEADER_MAX_SIZE]) {
+    uint32_t size = HEADER_FIXED_SIZE;
+
+    if (header->version == 1) {
+        uint16_t permissions = header->permissions;
+
+        permissions |= header->flags & HEADER_RLE ? HEADER_V1_RLE : 0;
+        permissions |= header->flags & HEADER_WIDE ? HEADER_V1_WIDE : 0;
+        store_le(buf, MAGIC, 4);
+        store_le(buf + 4, permissions, 2);
+        store_le(buf + 6, header->tree_size, 2);
+        store_le(buf + 8, header->file_size, 8);
+        return HEADER_V1_SIZE;
+    }
+
+    size += pack_tlv(buf + size, TLV_CHECKSUM, header->checksum);
+    size += pack_tlv(buf + size, TLV_TREE_FORMAT, header->tree_format);
+    store_le(buf, MAGIC_V2, 4);
+    buf[4] = header->version;
+    buf[5] = 0;
+    store_le(buf + 6, header->permissions, 2);
+    store_le(buf + 8, header->flags, 4);
+    store_le(buf + 12, header->file_size, 8);
+    store_le(buf + 20, size - HEADER_FIXED_SIZE, 2);
+    return size;
+}
+
+// Write a header to the start of an encoded file.
+//
+// Input parameters:
+// ofd: int: File descriptor of the encoded file
+// header: Header *: Header to write
+// Returns: uint32_t: Number of bytes written, or 0 if the write came up short
+uint32_t write_header(int ofd, Header *header) {
+    uint8_t buf[HEADER_MAX_SIZE];
+    uint32_t size = pack_header(header, buf);
+
+    if (write_bytes(ofd, buf, (int) size) != (int) size) {
+        return 0;
+    }
+    return size;
+}
+
+// Read the TLVs of a version 2 header, and check that the file is one
+// this decoder can decode: its checksum and tree format must be the ones
+// it knows. Types it does not know are skipped.
+//
+// Input parameters:
+// header: Header *: Header to fill in from the TLVs
+// buf: uint8_t *: The TLVs
+// size: uint32_t: Number of bytes of TLVs
+// Returns: bool: false if the TLVs are malformed or unsupported, true otherwise
+static bool parse_tlvs(Header *header, uint8_t *buf, uint32_t size) {
+    uint32_t pos = 0;
+
+    while (pos < size) {
+        uint32_t length;
+
+        if (size - pos < 3 || (length = (uint32_t) load_le(buf + pos + 1, 2)) > size - pos - 3) {
+            return false;
+        }
+        if (buf[pos] == TLV_CHECKSUM && length == 1) {
+            header->checksum = buf[pos + 3];
+        } else if (buf[pos] == TLV_TREE_FORMAT && length == 1) {
+            header->tree_format = buf[pos + 3];
+        }
+        pos += 3 + length;
+    }
+    return header->checksum == CHECKSUM_CRC32C && header->tree_format == TREE_POSTORDER;
+}
+
+// Read the rest of a header whose magic number is already in buf.
+// See read_header().
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded file
+// buf: uint8_t []: Buffer of HEADER_MAX_SIZE bytes, starting with the magic number
+// header: Header *: Filled in with the header that was read
+// Returns: bool: false if there is no valid header, or one with features this decoder lacks
+static bool read_header_rest(int ifd, uint8_t buf[static HEADER_MAX_SIZE], Header *header) {
+    uint32_t magic = (uint32_t) load_le(buf, 4);
+    uint32_t tlv_size;
+
+    header_init(header, 0, 0);
+
+    if (magic == MAGIC) {
+        uint16_t permissions;
+
+        if (read_bytes(ifd, buf + 4, HEADER_V1_SIZE - 4) != HEADER_V1_SIZE - 4) {
+            return false;
+        }
+        permissions = (uint16_t) load_le(buf + 4, 2);
+        header->version = 1;
+        header->permissions = permissions & HEADER_PERMISSIONS;
+        header->flags |= permissions & HEADER_V1_RLE ? HEADER_RLE : 0;
+        header->flags |= permissions & HEADER_V1_WIDE ? HEADER_WIDE : 0;
+        header->tree_size = (uint16_t) load_le(buf + 6, 2);
+        header->file_size = load_le(buf + 8, 8);
+        return true;
+    }
+
+    if (magic == MAGIC_SMALL) {
+        if (read_bytes(ifd, buf + 4, 4) != 4) {
+            return false;
+        }
+        header->version = HEADER_SMALL_VERSION;
+        header->permissions = (uint16_t) load_le(buf + 4, 2) & HEADER_PERMISSIONS;
+        header->file_size = load_le(buf + 6, 2);
+        return true;
+    }
+
+    if (magic != MAGIC_V2
+        || read_bytes(ifd, buf + 4, HEADER_FIXED_SIZE - 4) != HEADER_FIXED_SIZE - 4) {
+        return false;
+    }
+    header->version = buf[4];
+    header->permissions = (uint16_t) load_le(buf + 6, 2) & HEADER_PERMISSIONS;
+    header->flags = (uint32_t) load_le(buf + 8, 4);
+    header->file_size = load_le(buf + 12, 8);
+    tlv_size = (uint32_t) load_le(buf + 20, 2);
+    if (header->version != HEADER_VERSION || (header->flags & ~HEADER_FLAGS) != 0
+        || tlv_size > HEADER_MAX_TLV
+        || read_bytes(ifd, buf + HEADER_FIXED_SIZE, (int) tlv_size) != (int) tlv_size) {
+        return false;
+    }
+    return parse_tlvs(header, buf + HEADER_FIXED_SIZE, tlv_size);
+}
+
+// Read the header at the start of an encoded file, in any version, or
+// of a small object, and check its magic number. A version 1 header's
+// flags are taken out of its permissions, so that the rest of the
+// decoder need not tell the versions apart.
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded file
+// header: Header *: Filled in with the header that was read
+// Returns: bool: false if there is no valid header, or one with features this decoder lacks
+bool read_header(int ifd, Header *header) {
+    uint8_t buf[HEADER_MAX_SIZE];
+
+    if (read_bytes(ifd, buf, 4) != 4) {
+        header_init(header, 0, 0);
+        return false;
+    }
+    return read_header_rest(ifd, buf, header);
+}
+
+// Read the header of the next of several encoded files concatenated
+// together, once the one before it has been decoded, as read_header()
+// does. Reaching the end of ifd instead is not an error, and is told
+// apart from a header that is not valid by *end.
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded files, positioned after a trailer
+// header: Header *: Filled in with the header that was read
+// end: bool *: Set to whether ifd was at its end
+// Returns: bool: false at the end of ifd, or if there is no valid header there
+bool read_next_header(int ifd, Header *header, bool *end) {
+    uint8_t buf[HEADER_MAX_SIZE];
+
+    *end = read_bytes(ifd, buf, 1) == 0;
+    if (*end == true || read_bytes(ifd, buf + 1, 3) != 3) {
+        header_init(header, 0, 0);
+        return false;
+    }
+    return read_header_rest(ifd, buf, header);
+}
+
+// Lay a block header out as it goes in the file.
+//
+// Input parameters:
+// block: BlockHeader *: Block header to pack
+// buf: uint8_t []: Buffer of BLOCK_HEADER_SIZE bytes for it
+// Returns: void
+void pack_block_header(BlockHeader *block, uint8_t buf[static BLOCK_HEADER_SIZE]) {
+    store_le(buf, block->type, 2);
+    store_le(buf + 2, block->tree_size, 2);
+    store_le(buf + 4, block->checksum, 4);
+    store_le(buf + 8, block->raw_size, 8);
+    store_le(buf + 16, block->coded_size, 8);
+    return;
+}
+
+// Write a block header.
+//
+// Input parameters:
+// ofd: int: File descriptor of the encoded file
+// block: BlockHeader *: Block header to write
+// Returns: bool: false if the write came up short, true otherwise
+bool write_block_header(int ofd, BlockHeader *block) {
+    uint8_t buf[BLOCK_HEADER_SIZE];
+
+    pack_block_header(block, buf);
+    return write_bytes(ofd, buf, BLOCK_HEADER_SIZE) == BLOCK_HEADER_SIZE;
+}
+
+// Read a block header.
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded file
+// block: BlockHeader *: Filled in with the block header that was read
+// Returns: bool: false if the file ends first, true otherwise
+bool read_block_header(int ifd, BlockHeader *block) {
+    uint8_t buf[BLOCK_HEADER_SIZE];
+
+    if (read_bytes(ifd, buf, BLOCK_HEADER_SIZE) != BLOCK_HEADER_SIZE) {
+        return false;
+    }
+    block->type = (uint16_t) load_le(buf, 2);
+    block->tree_size = (uint16_t) load_le(buf + 2, 2);
+    block->checksum = (uint32_t) load_le(buf + 4, 4);
+    block->raw_size = load_le(buf + 8, 8);
+    block->coded_size = load_le(buf + 16, 8);
+    return true;
+}
+
+// Write the trailer after the last block.
+//
+// Input parameters:
+// ofd: int: File descriptor of the encoded file
+// trailer: Trailer *: Trailer to write
+// Returns: bool: false if the write came up short, true otherwise
+bool write_trailer(int ofd, Trailer *trailer) {
+    uint8_t buf[TRAILER_SIZE];
+
+    store_le(buf, trailer->checksum, 4);
+    return write_bytes(ofd, buf, TRAILER_SIZE) == TRAILER_SIZE;
+}
+
+// Read the trailer after the last block.
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded file
+// trailer: Trailer *: Filled in with the trailer that was read
+// Returns: bool: false if the file ends first, true otherwise
+bool read_trailer(int ifd, Trailer *trailer) {
+    uint8_t buf[TRAILER_SIZE];
+
+    if (read_bytes(ifd, buf, TRAILER_SIZE) != TRAILER_SIZE) {
+        return false;
+    }
+    trailer->checksum = (uint32_t) load_le(buf, 4);
+    return true;
+}
+
+// Write the block index after the last block.
+//
+// Input parameters:
+// ofd: int: File descriptor of the encoded file
+// entries: IndexEntry *: Where each block is
+// count: uint32_t: Number of blocks
+// Returns: bool: false if a write came up short, true otherwise
+bool write_index(int ofd, IndexEntry *entries, uint32_t count) {
+    uint8_t buf[INDEX_ENTRY_SIZE];
+
+    for (uint32_t i = 0; i < count; i++) {
+        store_le(buf, entries[i].offset, 8);
+        store_le(buf + 8, entries[i].position, 8);
+        if (write_bytes(ofd, buf, INDEX_ENTRY_SIZE) != INDEX_ENTRY_SIZE) {
+            return false;
+        }
+    }
+    store_le(buf, count, INDEX_COUNT_SIZE);
+    return write_bytes(ofd, buf, INDEX_COUNT_SIZE) == INDEX_COUNT_SIZE;
+}
+
+// Read past the block index after the last block, which a decoder
+// reading the blocks in order has no use for, and check that it counts
+// as many blocks as were read.
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded file
+// count: uint64_t: Number of blocks read
+// Returns: bool: false if the file ends first or the count is wrong, true otherwise
+bool skip_index(int ifd, uint64_t count) {
+    uint8_t buf[64 * INDEX_ENTRY_SIZE];
+
+    for (uint64_t left = count; left > 0;) {
+        int n = left < 64 ? (int) left : 64;
+
+        if (read_bytes(ifd, buf, n * INDEX_ENTRY_SIZE) != n * INDEX_ENTRY_SIZE) {
+            return false;
+        }
+        left -= n;
+    }
+    if (read_bytes(ifd, buf, INDEX_COUNT_SIZE) != INDEX_COUNT_SIZE) {
+        return false;
+    }
+    return load_le(buf, INDEX_COUNT_SIZE) == count;
+}
+
+// Read the block index and trailer of a file flagged with HEADER_INDEX
+// from the end of the file, without reading its blocks. The offsets must
+// go up, and end before the index.
+//
+// Input parameters:
+// fd: int: File descriptor of the encoded file, which must be seekable
+// entries: IndexEntry **: Set to the entries, which the caller frees
+// count: uint32_t *: Set to the number of entries
+// trailer: Trailer *: Filled in with the trailer
+// Returns: int64_t: Offset of the index, where the blocks end, or -1 if it is malformed
+int64_t load_index(int fd, IndexEntry **entries, uint32_t *count, Trailer *trailer) {
+    uint8_t tail[INDEX_COUNT_SIZE + TRAILER_SIZE];
+    uint8_t *buf;
+    off_t end, start;
+
+    *entries = NULL;
+    *count = 0;
+    if ((end = lseek(fd, 0, SEEK_END)) < (off_t) sizeof(tail)
+        || pread(fd, tail, sizeof(tail), end - (off_t) sizeof(tail)) != (ssize_t) sizeof(tail)) {
+        return -1;
+    }
+    *count = (uint32_t) load_le(tail, INDEX_COUNT_SIZE);
+    trailer->checksum = (uint32_t) load_le(tail + INDEX_COUNT_SIZE, 4);
+    if ((uint64_t) *count * INDEX_ENTRY_SIZE > (uint64_t) end - sizeof(tail)) {
+        return -1;
+    }
+    start = end - (off_t) sizeof(tail) - (off_t) *count * INDEX_ENTRY_SIZE;
+
+    buf = (uint8_t *) malloc((size_t) *count * INDEX_ENTRY_SIZE + 1);
+    *entries = (IndexEntry *) malloc(((size_t) *count + 1) * sizeof(IndexEntry));
+    if (pread(fd, buf, (size_t) *count * INDEX_ENTRY_SIZE, start)
+        != (ssize_t) *count * INDEX_ENTRY_SIZE) {
+        start = -1;
+    }
+    for (uint32_t i = 0; start != -1 && i < *count; i++) {
+        (*entries)[i].offset = load_le(buf + i * INDEX_ENTRY_SIZE, 8);
+        (*entries)[i].position = load_le(buf + i * INDEX_ENTRY_SIZE + 8, 8);
+        if ((*entries)[i].offset >= (uint64_t) start
+            || (i > 0 && (*entries)[i].offset <= (*entries)[i - 1].offset)) {
+            start = -1;
+        }
+    }
+    free(buf);
+    return start;
+}
@@ -1,10 +1,137 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+// Version 2 files start with MAGIC_V2, and are laid out little-endian,
+// field by field, whatever the host:
+//
+//   u32 magic, u8 version, u8 reserved (0), u16 permissions,
+//   u32 flags, u64 file_size, u16 tlv_size, tlv_size bytes of TLVs
+//
+// flags is a set of HEADER_* features that the body uses. A decoder
+// must refuse a file with a flag it does not know, since it cannot
+// decode the body right. The TLVs describe the file further, each as a
+// u8 type, a u16 length and that many bytes of value. Unknown types are
+// skipped, so new ones can be added without breaking older decoders.
+//
+// Version 1 files start with MAGIC, and hold a 16-byte header with a u16
+// tree_size after the permissions, and no flags or TLVs. Their flags
+// live in the bits of the permissions above the file mode. read_header()
+// takes both, and leaves the flags of either in flags.
+//
+// Small objects start with MAGIC_SMALL, and are laid out as small.h
+// describes. read_header() reads their magic, permissions and size, and
+// gives them a version of HEADER_SMALL_VERSION.
+#define HEADER_VERSION     2 // Version that encode writes by default.
+#define HEADER_PERMISSIONS 0777
+#define HEADER_RLE         0x1 // Blocks hold the input run-length coded.
+#define HEADER_WIDE        0x2 // Blocks may be BLOCK_WIDE.
+#define HEADER_INDEX       0x4 // A block index comes before the Trailer.
+#define HEADER_ANS         0x8 // Blocks may be BLOCK_ANS.
+#define HEADER_FLAGS       (HEADER_RLE | HEADER_WIDE | HEADER_INDEX | HEADER_ANS) // Every flag known.
+#define HEADER_V1_RLE      0x8000 // HEADER_RLE in a version 1 file.
+#define HEADER_V1_WIDE     0x4000 // HEADER_WIDE in a version 1 file.
+
+#define HEADER_SMALL_VERSION 0 // Version read_header() gives a small object.
+
+#define HEADER_V1_SIZE    16 // Size of a version 1 header.
+#define HEADER_FIXED_SIZE 22 // Size of a version 2 header without TLVs.
+#define HEADER_MAX_TLV    1024 // Most bytes of TLVs a header may carry.
+#define HEADER_MAX_SIZE   (HEADER_FIXED_SIZE + HEADER_MAX_TLV)
+#define BLOCK_HEADER_SIZE 24 // Size of a BlockHeader in the file.
+#define TRAILER_SIZE      4 // Size of a Trailer in the file.
+#define INDEX_ENTRY_SIZE  16 // Size of an IndexEntry in the file.
+#define INDEX_COUNT_SIZE  4 // Size of the count that ends a block index.
+
+#define TLV_CHECKSUM    1 // u8: How blocks and files are checksummed.
+#define TLV_TREE_FORMAT 2 // u8: How tree dumps are laid out.
+
+#define CHECKSUM_CRC32C 1 // CRC32C, as in checksum.h.
+#define TREE_POSTORDER  1 // 'L' and a symbol per leaf, 'I' per interior node, post-order.
+
+// A tree_size of 0 means that the file body is a sequence of blocks,
+// each one starting with a BlockHeader, and ends with a Trailer. Version
+// 1 files that carry a non-zero tree_size hold a single tree dump
+// followed by the coded bits, and have no checksums.
+//
+// With HEADER_RLE, the sizes and checksums of the blocks are those of
+// the run-length coded input, while file_size and the Trailer are those
+// of the input itself.
+//
+// A BLOCK_CACHED block has a tree_size of 8, and holds the uint64_t id
+// of a tree in a tree cache file in place of the tree dump.
+//
+// A BLOCK_WIDE block has no tree dump, and the header of a file with
+// one is flagged with HEADER_WIDE, so that a decoder knows before it
+// starts whether it needs room for a WideWorkspace. Its coded_size bytes
+// hold a uint32_t table size, the table of code lengths from
+// wide_dump_table(), the coded bits, and the last byte as is when
+// raw_size is odd.
+//
+// With HEADER_INDEX, the last block is followed by a block index: an
+// IndexEntry for each block, and a u32 count of them, right before the
+// Trailer. It can be found from the end of the file, so blocks can be
+// added to a file in place of its index without reading the blocks
+// already there. encode writes one in every version 2 file.
+//
+// A BLOCK_ANS block holds a tANS table in place of the tree dump, and
+// is laid out as ans.h describes. The header of a file that may have one
+// is flagged with HEADER_ANS, so that older decoders refuse it up front.
+//
+// Every integer in the body is little-endian as well.
 typedef struct {
-    uint32_t magic;
-    uint16_t permissions;
-    uint16_t tree_size;
+    uint8_t version;
+    uint16_t permissions; // File mode of the input.
+    uint16_t tree_size; // Version 1 only.
+    uint32_t flags;
     uint64_t file_size;
+    uint8_t checksum; // From TLV_CHECKSUM.
+    uint8_t tree_format; // From TLV_TREE_FORMAT.
 } Header;
+
+// Written as u16 type, u16 tree_size, u32 checksum, u64 raw_size and
+// u64 coded_size.
+typedef struct {
+    uint16_t type;
+    uint16_t tree_size;
+    uint32_t checksum; // CRC32C of the block before coding.
+    uint64_t raw_size;
+    uint64_t coded_size;
+} BlockHeader;
+
+typedef struct {
+    uint32_t checksum; // CRC32C of the whole file.
+} Trailer;
+
+// Written as u64 offset and u64 position.
+typedef struct {
+    uint64_t offset; // Of the block's BlockHeader in the file.
+    uint64_t position; // Of the block's first byte in the bytes coded.
+} IndexEntry;
+
+void header_init(Header *header, uint16_t permissions, uint64_t file_size);
+
+uint32_t pack_header(Header *header, uint8_t buf[static HEADER_MAX_SIZE]);
+
+uint32_t write_header(int ofd, Header *header);
+
+bool read_header(int ifd, Header *header);
+
+bool read_next_header(int ifd, Header *header, bool *end);
+
+void pack_block_header(BlockHeader *block, uint8_t buf[static BLOCK_HEADER_SIZE]);
+
+bool write_block_header(int ofd, BlockHeader *block);
+
+bool read_block_header(int ifd, BlockHeader *block);
+
+bool write_trailer(int ofd, Trailer *trailer);
+
+bool read_trailer(int ifd, Trailer *trailer);
+
+bool write_index(int ofd, IndexEntry *entries, uint32_t count);
+
+bool skip_index(int ifd, uint64_t count);
+
+int64_t load_index(int fd, IndexEntry **entries, uint32_t *count, Trailer *trailer);
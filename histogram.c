@@ -0,0 +1,74 @@
+#include "histogram.h"
+#include "checksum.h"
+#include "io.h"
+
+#include <string.h>
+
+// Write byte counts out as a histogram file.
+//
+// Input parameters:
+// fd: int: File descriptor to write to
+// hist: const uint64_t *: Count of each byte
+// Returns: bool: false if the file cannot be written, true otherwise
+bool histogram_save(int fd, const uint64_t hist[static ALPHABET]) {
+    uint8_t buf[HISTOGRAM_MAX_SIZE] = { 0 };
+    uint32_t pos = 4 + ALPHABET / 8;
+
+    store_le(buf, HISTOGRAM_MAGIC, 4);
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        if (hist[i] != 0) {
+            buf[4 + i / 8] |= (uint8_t) (1 << (i % 8));
+            store_le(buf + pos, hist[i], 8);
+            pos += 8;
+        }
+    }
+    store_le(buf + pos, crc32c(0, buf, pos), 4);
+    pos += 4;
+    return write_bytes(fd, buf, (int) pos) == (int) pos;
+}
+
+// Read the byte counts from a histogram file, which has to be the whole
+// of fd, and have the checksum it was written with.
+//
+// Input parameters:
+// fd: int: File descriptor to read from
+// hist: uint64_t *: Filled in with the count of each byte
+// Returns: bool: false if fd is not a whole histogram file, true otherwise
+bool histogram_load(int fd, uint64_t hist[static ALPHABET]) {
+    uint8_t buf[HISTOGRAM_MAX_SIZE + 1];
+    uint32_t pos = 4 + ALPHABET / 8;
+    int size = read_bytes(fd, buf, sizeof(buf));
+
+    if (size < (int) pos + 4 || size > HISTOGRAM_MAX_SIZE || load_le(buf, 4) != HISTOGRAM_MAGIC) {
+        return false;
+    }
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        hist[i] = 0;
+        if ((buf[4 + i / 8] >> (i % 8)) & 1) {
+            if ((int) pos + 8 + 4 > size) {
+                return false;
+            }
+            hist[i] = load_le(buf + pos, 8);
+            pos += 8;
+        }
+    }
+    return (int) pos + 4 == size && load_le(buf + pos, 4) == crc32c(0, buf, pos);
+}
+
+// Add one set of byte counts to another.
+//
+// Input parameters:
+// sum: uint64_t *: Counts to add to
+// hist: const uint64_t *: Counts to add
+// Returns: bool: false if a count would overflow, leaving sum unchanged, true otherwise
+bool histogram_add(uint64_t sum[static ALPHABET], const uint64_t hist[static ALPHABET]) {
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        if (sum[i] > UINT64_MAX - hist[i]) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        sum[i] += hist[i];
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HISTOGRAM_MAGIC    0x48465548 // "HUFH", at the start of a histogram file.
+#define HISTOGRAM_MAX_SIZE (4 + ALPHABET / 8 + 8 * ALPHABET + 4) // Largest histogram file.
+
+// A histogram file holds the byte counts of an input, so that those of
+// many inputs, such as the shards of one dataset, can be summed and one
+// tree built from them all. It is laid out little-endian as
+//
+//   u32 HISTOGRAM_MAGIC, bitmap, u64 count of each byte in it, u32 CRC32C
+//
+// where the bitmap has a bit for each byte that occurs, lowest byte in
+// the lowest bit, and the CRC32C covers everything before it.
+
+bool histogram_save(int fd, const uint64_t hist[static ALPHABET]);
+
+bool histogram_load(int fd, uint64_t hist[static ALPHABET]);
+
+bool histogram_add(uint64_t sum[static ALPHABET], const uint64_t hist[static ALPHABET]);
@@ -0,0 +1,114 @@
+#include "fdpass.h"
+#include "huffd.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Usage Function
+// Input parameters:
+// exec_name: char *: Name of the program
+// Returns: void
+void usage(char *exec_name) {
+    printf("USAGE: %s -i <infile> -o <outfile> [-s <socket>][-r <count>][-dvh]\n", exec_name);
+    printf("-i <infile>: File to compress or decompress\n");
+    printf("-o <outfile>: File to write the result to\n");
+    printf("-s <socket>: Socket huffd listens on. Default is %s\n", HUFFD_SOCKET);
+    printf("-r <count>: Send the same request count times, for load testing\n");
+    printf("-d: Decompress instead of compress\n");
+    printf("-v: Print the sizes reported by huffd to stderr\n");
+    printf("-h: Print this message\n");
+    return;
+}
+
+// The main function. Opens the files, passes them to huffd, and waits
+// for it to report back.
+//
+// Input parameters:
+// argc: int: Number of input arguments
+// argv: char **: The input arguments
+// Returns: int: 0 in case of success, non-zero for failure
+int main(int argc, char **argv) {
+    int opt;
+    char *infile = NULL;
+    char *outfile = NULL;
+    char *path = HUFFD_SOCKET;
+    bool verbose = false;
+    long repeat = 1;
+    struct sockaddr_un addr = { 0 };
+    HuffdRequest req = { HUFFD_MAGIC, HUFFD_COMPRESS };
+    HuffdReply reply;
+    struct stat statbuf;
+    int fds[2];
+    int nfds;
+    int sock;
+
+    // Parse the input options.
+    while ((opt = getopt(argc, argv, "i:o:s:r:dvh")) != -1) {
+        switch (opt) {
+        case ('i'): infile = optarg; break;
+        case ('o'): outfile = optarg; break;
+        case ('s'): path = optarg; break;
+        case ('r'): repeat = strtol(optarg, NULL, 10); break;
+        case ('d'): req.op = HUFFD_DECOMPRESS; break;
+        case ('v'): verbose = true; break;
+        case ('h'): usage(argv[0]); return 0;
+        default: usage(argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (infile == NULL || outfile == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((fds[0] = open(infile, O_RDONLY)) == -1) {
+        printf("Unable to open input file for reading\n");
+        return 1;
+    }
+    fstat(fds[0], &statbuf);
+    if ((fds[1] = open(outfile, O_CREAT | O_RDWR | O_TRUNC, statbuf.st_mode & 0777)) == -1) {
+        printf("Unable to open output file for writing\n");
+        return 1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1
+        || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror(path);
+        return 1;
+    }
+
+    // The daemon works on the same open files, so both are rewound
+    // before every request.
+    for (long i = 0; i < repeat; i++) {
+        lseek(fds[0], 0, SEEK_SET);
+        lseek(fds[1], 0, SEEK_SET);
+        if (ftruncate(fds[1], 0) == -1 || send_fds(sock, &req, sizeof(req), fds, 2) == false
+            || recv_fds(sock, &reply, sizeof(reply), NULL, &nfds) == false
+            || reply.magic != HUFFD_MAGIC) {
+            fprintf(stderr, "Lost the connection to huffd\n");
+            return 1;
+        }
+        if (reply.status != 0) {
+            fprintf(stderr, "huffd failed the request with status %u\n", reply.status);
+            return 1;
+        }
+    }
+
+    if (verbose == true) {
+        fprintf(stderr, "Input size = %lu bytes\n", (unsigned long) reply.in_size);
+        fprintf(stderr, "Output size = %lu bytes\n", (unsigned long) reply.out_size);
+    }
+
+    close(sock);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include "decoder.h"
+#include "encoder.h"
+#include "fdpass.h"
+#include "huffd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define QUEUE_SIZE 64 // Connections with a request waiting for a worker.
+
+// Each worker owns its scratch space, allocated once at startup, and
+// builds its trees in arrays on its own stack, so serving a request
+// allocates nothing.
+typedef struct {
+    pthread_t thread;
+    Encoder *encoder;
+    Decoder *decoder;
+} Worker;
+
+// Connections with a request waiting for a worker.
+static int queue[QUEUE_SIZE];
+static uint32_t queue_head = 0;
+static uint32_t queue_size = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_space = PTHREAD_COND_INITIALIZER;
+
+// A worker writes a connection it is done with here, for the main
+// thread to wait on again.
+static int idle_pipe[2];
+
+static volatile sig_atomic_t running = 1;
+
+// Usage Function
+// Input parameters:
+// exec_name: char *: Name of the program
+// Returns: void
+void usage(char *exec_name) {
+    printf("USAGE: %s [-s <socket>][-n <threads>][-h]\n", exec_name);
+    printf("-s <socket>: Unix domain socket to listen on. Default is %s\n", HUFFD_SOCKET);
+    printf("-n <threads>: Number of worker threads. Default is one per CPU\n");
+    printf("-h: Print this message\n");
+    return;
+}
+
+// Stop accepting connections on SIGINT or SIGTERM.
+//
+// Input parameters:
+// sig: int: Signal number
+// Returns: void
+void handle_signal(int sig) {
+    (void) sig;
+    running = 0;
+    return;
+}
+
+// Add an accepted connection to the queue, waiting while it is full.
+//
+// Input parameters:
+// conn: int: Connected socket
+// Returns: void
+void queue_push(int conn) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_size == QUEUE_SIZE) {
+        pthread_cond_wait(&queue_space, &queue_lock);
+    }
+    queue[(queue_head + queue_size) % QUEUE_SIZE] = conn;
+    queue_size += 1;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    return;
+}
+
+// Take the oldest connection off the queue, waiting while it is empty.
+//
+// Input parameters: None
+// Returns: int: Connected socket
+int queue_pop(void) {
+    int conn;
+
+    pthread_mutex_lock(&queue_lock);
+    while (queue_size == 0) {
+        pthread_cond_wait(&queue_ready, &queue_lock);
+    }
+    conn = queue[queue_head];
+    queue_head = (queue_head + 1) % QUEUE_SIZE;
+    queue_size -= 1;
+    pthread_cond_signal(&queue_space);
+    pthread_mutex_unlock(&queue_lock);
+    return conn;
+}
+
+// Carry out one request on the descriptors that came with it.
+//
+// Input parameters:
+// w: Worker *: Worker whose scratch space to use
+// req: HuffdRequest *: Request to carry out
+// ifd: int: Input file descriptor
+// ofd: int: Output file descriptor
+// reply: HuffdReply *: Filled in with the outcome
+// Returns: void
+void serve_request(Worker *w, HuffdRequest *req, int ifd, int ofd, HuffdReply *reply) {
+    EncodeOptions opts = { 0 };
+    struct stat statbuf;
+    Header header;
+
+    if (req->op == HUFFD_COMPRESS) {
+        if (fstat(ifd, &statbuf) != 0) {
+            reply->status = HUFFD_ERR_INPUT;
+            return;
+        }
+        if (encode_file(w->encoder, ifd, ofd, statbuf.st_mode & 0777, &opts) == false) {
+            reply->status = w->encoder->no_memory == true      ? HUFFD_ERR_MEMORY
+                            : w->encoder->write_failed == true ? HUFFD_ERR_OUTPUT
+                                                               : HUFFD_ERR_INPUT;
+            return;
+        }
+        reply->in_size = w->encoder->file_size;
+        reply->out_size = w->encoder->out_size;
+    } else if (req->op == HUFFD_DECOMPRESS) {
+        if (read_header(ifd, &header) == false) {
+            reply->status = HUFFD_ERR_HEADER;
+            return;
+        }
+        reply->status = decode_file(w->decoder, ifd, ofd, &header);
+        reply->in_size = lseek(ifd, 0, SEEK_CUR);
+        reply->out_size = header.file_size;
+    } else {
+        reply->status = HUFFD_ERR_REQUEST;
+    }
+    return;
+}
+
+// Worker thread. Serves one request from a connection, then hands the
+// connection back to the main thread to wait for the next one, so that
+// a client between requests does not hold a worker.
+//
+// Input parameters:
+// arg: void *: The Worker this thread runs as
+// Returns: void *: Never returns
+void *worker_main(void *arg) {
+    Worker *w = (Worker *) arg;
+
+    while (true) {
+        int conn = queue_pop();
+        HuffdRequest req;
+        HuffdReply reply;
+        int fds[2];
+        int nfds;
+
+        if (recv_fds(conn, &req, sizeof(req), fds, &nfds) == false) {
+            for (int i = 0; i < nfds; i++) {
+                close(fds[i]);
+            }
+            close(conn);
+            continue;
+        }
+        memset(&reply, 0, sizeof(reply));
+        reply.magic = HUFFD_MAGIC;
+        if (req.magic != HUFFD_MAGIC || nfds != 2) {
+            reply.status = HUFFD_ERR_REQUEST;
+        } else {
+            serve_request(w, &req, fds[0], fds[1], &reply);
+        }
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        if (send_fds(conn, &reply, sizeof(reply), NULL, 0) == false
+            || write(idle_pipe[1], &conn, sizeof(conn)) != sizeof(conn)) {
+            close(conn);
+        }
+    }
+    return NULL;
+}
+
+// Add a connection to those the main thread waits on, growing the set
+// as needed.
+//
+// Input parameters:
+// set: struct pollfd **: Set to add to, which may be moved
+// size: nfds_t *: Number of entries in use
+// capacity: nfds_t *: Number of entries allocated
+// conn: int: Connected socket
+// Returns: bool: false if there is no memory for it, true otherwise
+bool watch_conn(struct pollfd **set, nfds_t *size, nfds_t *capacity, int conn) {
+    struct pollfd *grown;
+
+    if (*size == *capacity) {
+        if ((grown = (struct pollfd *) realloc(*set, 2 * *capacity * sizeof(struct pollfd))) == NULL) {
+            return false;
+        }
+        *set = grown;
+        *capacity *= 2;
+    }
+    (*set)[*size].fd = conn;
+    (*set)[*size].events = POLLIN;
+    (*size) += 1;
+    return true;
+}
+
+// The main function. Sets up the workers and the listening socket, then
+// waits on it and on every idle connection, and hands each connection
+// with a request to the workers, till it is signalled.
+//
+// Input parameters:
+// argc: int: Number of input arguments
+// argv: char **: The input arguments
+// Returns: int: 0 in case of success, non-zero for failure
+int main(int argc, char **argv) {
+    int opt;
+    char *path = HUFFD_SOCKET;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct sockaddr_un addr = { 0 };
+    struct sigaction sa = { 0 };
+    Worker *workers;
+    struct pollfd *set;
+    nfds_t size = 2, capacity = 64;
+    int sock;
+
+    // Parse the input options.
+    while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+        switch (opt) {
+        case ('s'): path = optarg; break;
+        case ('n'): nthreads = strtol(optarg, NULL, 10); break;
+        case ('h'): usage(argv[0]); return 0;
+        default: usage(argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long\n");
+        return 1;
+    }
+
+    // No SA_RESTART, so that accept() returns once a signal arrives.
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGXFSZ, SIG_IGN);
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1
+        || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sock, 128) == -1) {
+        perror(path);
+        return 1;
+    }
+
+    if (pipe2(idle_pipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return 1;
+    }
+
+    workers = (Worker *) calloc(nthreads, sizeof(Worker));
+    set = (struct pollfd *) calloc(capacity, sizeof(struct pollfd));
+    if (workers == NULL || set == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < nthreads; i++) {
+        workers[i].encoder = (Encoder *) calloc(1, sizeof(Encoder));
+        workers[i].decoder = (Decoder *) calloc(1, sizeof(Decoder));
+        if (workers[i].encoder == NULL || workers[i].decoder == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        pthread_detach(workers[i].thread);
+    }
+
+    // Entry 0 is the listening socket and entry 1 the connections the
+    // workers are done with. The rest are idle connections.
+    set[0].fd = sock;
+    set[0].events = POLLIN;
+    set[1].fd = idle_pipe[0];
+    set[1].events = POLLIN;
+    while (running) {
+        int conn;
+
+        if (poll(set, size, -1) == -1) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            continue;
+        }
+
+        // Hand on the connections with a request, or that hung up, which
+        // the worker finds out and closes.
+        for (nfds_t i = size - 1; i >= 2; i--) {
+            if (set[i].revents != 0) {
+                queue_push(set[i].fd);
+                set[i] = set[--size];
+            }
+        }
+        if ((set[1].revents & POLLIN) != 0 && read(idle_pipe[0], &conn, sizeof(conn)) == sizeof(conn)
+            && watch_conn(&set, &size, &capacity, conn) == false) {
+            close(conn);
+        }
+        if ((set[0].revents & POLLIN) != 0 && (conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) != -1
+            && watch_conn(&set, &size, &capacity, conn) == false) {
+            close(conn);
+        }
+    }
+
+    close(sock);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#define HUFFD_MAGIC      0x48554644 // "HUFD", starts every message.
+#define HUFFD_SOCKET     "/tmp/huffd.sock" // Default socket path.
+#define HUFFD_COMPRESS   1
+#define HUFFD_DECOMPRESS 2
+
+// A request is sent together with two file descriptors, the input and
+// the output, passed with SCM_RIGHTS. The daemon reads and writes them
+// directly, so the payload never goes over the socket.
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+} HuffdRequest;
+
+// Sent back once a request is done. A status of 0 means success, and any
+// other value is a DecodeStatus or one of the HUFFD_ERR codes below.
+typedef struct {
+    uint32_t magic;
+    uint32_t status;
+    uint64_t in_size;
+    uint64_t out_size;
+} HuffdReply;
+
+#define HUFFD_ERR_REQUEST 100 // Malformed request or missing descriptors.
+#define HUFFD_ERR_HEADER  101 // The input to decompress has no valid header.
+#define HUFFD_ERR_INPUT   102 // The input to compress cannot be examined or rewound.
+#define HUFFD_ERR_MEMORY  103 // The input to compress needs more memory than there is.
+#define HUFFD_ERR_OUTPUT  104 // The output of a compression could not be written in full.
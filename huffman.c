@@ -1,103 +1,157 @@
 #include "huffman.h"
 #include "code.h"
+#include "io.h"
 #include "pq.h"
-#include "stack.h"
 
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-void print_tree(Node *node);
-extern Code c;
-
 // Constructs a Huffman tree given a computed histogram.
 //
+// As with rebuild_tree(), the nodes are taken from the caller's nodes in
+// order, and the queue is an array of its own, so that nothing is
+// allocated. ALPHABET leaves and one fewer interior nodes are MAX_NODES.
+// The tree lives as long as nodes does, and is not to be deleted.
+//
 // Input parameters
 // hist: uint64_t[]: Histogram of size ALPHABET to be used for the tree
+// nodes: Node []: Storage for the nodes of the tree
 // Returns: Node *: Pointer to the root node of the tree.
-Node *build_tree(uint64_t hist[static ALPHABET]) {
+Node *build_tree(uint64_t hist[static ALPHABET], Node nodes[static MAX_NODES]) {
+    Node *queue[ALPHABET];
     Node *node, *left, *right;
-    PriorityQueue *pq;
-    uint32_t capacity = 0;
+    PriorityQueue pq;
+    uint32_t used = 0;
 
-    for (uint32_t i = 0; i < ALPHABET; i++) {
-        if (hist[i] != 0) {
-            capacity++;
-        }
-    }
-    pq = pq_create(capacity);
+    pq_init(&pq, queue, ALPHABET);
 
     // First, create nodes for all entries in the histogram,
     // and add them to the priority queue.
     for (uint16_t i = 0; i < ALPHABET; i++) {
         if (hist[i] != 0) {
-            node = node_create(i, hist[i]);
-            enqueue(pq, node);
+            node = &nodes[used++];
+            node->left = node->right = NULL;
+            node->symbol = i;
+            node->frequency = hist[i];
+            enqueue(&pq, node);
         }
     }
 
     // While there are >=2 nodes in the queue, dequeue two nodes,
     // join them, and add the resutant node to the queue.
-    while (pq_size(pq) >= 2) {
-        if ((dequeue(pq, &left) == true) && (dequeue(pq, &right) == true)) {
-            node = node_join(left, right);
-            enqueue(pq, node);
+    while (pq_size(&pq) >= 2) {
+        if ((dequeue(&pq, &left) == true) && (dequeue(&pq, &right) == true)) {
+            node = &nodes[used++];
+            node->left = left;
+            node->right = right;
+            node->symbol = '$';
+            node->frequency = left->frequency + right->frequency;
+            enqueue(&pq, node);
         }
     }
-    dequeue(pq, &node);
-    pq_delete(&pq);
+    node = NULL;
+    dequeue(&pq, &node);
     return node;
 }
 
-// Populates a code table, building the code for each symbol in the
-// Huffman tree.
+// Walks the tree, pushing a bit onto c on the way down each branch, and
+// copies c into the table at every leaf.
 //
 // Input parameters:
-// root: Node *: Root node of the Huffman tree.
+// root: Node *: Root node of the (sub)tree
+// c: Code *: Code leading to root
 // table: Code []: Code table
 // Returns: void
-void build_codes(Node *root, Code table[static ALPHABET]) {
+static void walk_codes(Node *root, Code *c, Code table[static ALPHABET]) {
     uint8_t popped_bit;
 
     if (root != NULL) {
         // If leaf node, add symbol to the code table
         if (root->left == NULL && root->right == NULL) {
-            table[root->symbol] = c;
+            table[root->symbol] = *c;
         } else {
-            code_push_bit(&c, 0);
-            build_codes(root->left, table);
-            code_pop_bit(&c, &popped_bit);
+            code_push_bit(c, 0);
+            walk_codes(root->left, c, table);
+            code_pop_bit(c, &popped_bit);
 
-            code_push_bit(&c, 1);
-            build_codes(root->right, table);
-            code_pop_bit(&c, &popped_bit);
+            code_push_bit(c, 1);
+            walk_codes(root->right, c, table);
+            code_pop_bit(c, &popped_bit);
         }
     }
     return;
 }
 
-// Dumps the contents of the tree into a file. Leaf nodes are represented
-// with the symbol L, followed by the symbol itself, and the interior
-// nodes are represented with the symbol I.
+// Populates a code table, building the code for each symbol in the
+// Huffman tree. The code under construction lives on the stack, so
+// several threads can build tables at once.
 //
 // Input parameters:
-// outfile: int: File descriptor of the output file
 // root: Node *: Root node of the Huffman tree.
+// table: Code []: Code table
 // Returns: void
-void dump_tree(int outfile, Node *root) {
+void build_codes(Node *root, Code table[static ALPHABET]) {
+    Code c = code_init();
+
+    walk_codes(root, &c, table);
+    return;
+}
+
+// Computes the exact number of bits that the coded symbols will take up
+// when every symbol in the histogram is replaced by its code.
+//
+// Input parameters:
+// hist: uint64_t[]: Histogram of size ALPHABET
+// table: Code []: Code table built from the same histogram
+// Returns: uint64_t: Number of coded bits
+uint64_t coded_bits(uint64_t hist[static ALPHABET], Code table[static ALPHABET]) {
+    uint64_t bits = 0;
+
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        if (hist[i] != 0) {
+            bits += hist[i] * code_size(&table[i]);
+        }
+    }
+    return bits;
+}
+
+// Flattens the tree into a buffer, in the same post-order as the dump:
+// leaf nodes are represented with the symbol L, followed by the symbol
+// itself, and the interior nodes are represented with the symbol I.
+//
+// Input parameters:
+// root: Node *: Root node of the Huffman tree.
+// buf: uint8_t *: Buffer of at least MAX_TREE_SIZE bytes
+// Returns: uint16_t: Number of bytes written to buf
+uint16_t flatten_tree(Node *root, uint8_t *buf) {
+    uint16_t n = 0;
+
     if (root != NULL) {
-        dump_tree(outfile, root->left);
-        dump_tree(outfile, root->right);
+        n += flatten_tree(root->left, buf + n);
+        n += flatten_tree(root->right, buf + n);
 
         // If leaf node
         if (root->left == NULL && root->right == NULL) {
-            write(outfile, "L", 1);
-            write(outfile, &(root->symbol), 1);
+            buf[n++] = 'L';
+            buf[n++] = root->symbol;
         } else {
-            write(outfile, "I", 1);
+            buf[n++] = 'I';
         }
     }
+    return n;
+}
+
+// Dumps the contents of the tree into a file, as flattened by
+// flatten_tree(), in a single write.
+//
+// Input parameters:
+// outfile: int: File descriptor of the output file
+// root: Node *: Root node of the Huffman tree.
+// Returns: void
+void dump_tree(int outfile, Node *root) {
+    uint8_t buf[MAX_TREE_SIZE];
+
+    write_bytes(outfile, buf, flatten_tree(root, buf));
     return;
 }
 
@@ -105,70 +159,120 @@ void dump_tree(int outfile, Node *root) {
 // 'L' is encountered, the next byte is a leaf node symbol. 'I' represents
 // an interior node, that joins two leaf nodes.
 //
+// The dump comes from the input file, so it is checked as it is read, in
+// a single pass: every byte must be an 'L' followed by a symbol or an 'I'
+// with two subtrees under it, no symbol may appear twice, and the dump
+// must end with exactly one tree on the stack. Since every interior node
+// then has two children, the code lengths meet the Kraft inequality with
+// equality, and at most ALPHABET leaves keep every code within
+// MAX_CODE_SIZE bytes.
+//
+// The nodes are taken from the caller's nodes in order, and the stack is
+// an array of its own, so that nothing is allocated. A valid dump has at
+// most ALPHABET leaves and one fewer interior nodes, which is MAX_NODES.
+// The tree lives as long as nodes does, and is not to be deleted.
+//
 // Input parameters:
 // nbytes: uint16_t: Buffer size
 // tree: uint8_t []: Buffer to build the tree
-// Returns: Node *: Pointer to the root of the node
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
-    Node *n;
-    Node *left_child, *right_child;
-    Stack *s = stack_create(MAX_TREE_SIZE);
+// nodes: Node []: Storage for the nodes of the tree
+// Returns: Node *: Pointer to the root of the node, NULL if the dump is malformed
+Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes], Node nodes[static MAX_NODES]) {
+    Node *stack[ALPHABET];
+    uint32_t top = 0, used = 0;
+    bool seen[ALPHABET] = { false };
+
+    if (nbytes > MAX_TREE_SIZE) {
+        return NULL;
+    }
 
     for (uint16_t i = 0; i < nbytes; i++) {
-        if (tree[i] == 'L') { // Leaf node
+        Node *n = &nodes[used];
+
+        if (tree[i] == 'L' && i + 1 < nbytes) { // Leaf node
             i += 1;
-            n = node_create(tree[i], 0);
-            stack_push(s, n);
-        } else if (tree[i] == 'I') { // Interior node
-            stack_pop(s, &right_child);
-            stack_pop(s, &left_child);
-            n = node_join(left_child, right_child);
-            stack_push(s, n);
+            if (seen[tree[i]] || top == ALPHABET) {
+                return NULL;
+            }
+            seen[tree[i]] = true;
+            n->left = n->right = NULL;
+            n->symbol = tree[i];
+        } else if (tree[i] == 'I' && top >= 2) { // Interior node
+            n->right = stack[--top];
+            n->left = stack[--top];
+            n->symbol = '$';
+        } else {
+            return NULL;
         }
+        n->frequency = 0;
+        stack[top++] = n;
+        used += 1;
     }
-    stack_pop(s, &n);
-    stack_delete(&s);
-    // print_tree(n);
-    return n;
+
+    if (top != 1) {
+        return NULL;
+    }
+    return stack[0];
 }
 
-// Delete the tree to free memory using postorder traversal
+// Rebuild the tree from its dump as a packed array, for decoding with.
+// The dump is checked just as rebuild_tree() checks it. Entry 0 is the
+// root and the nodes follow breadth first, so a long code walks down
+// through a few cache lines rather than nodes scattered about. A leaf's
+// entry is PACKED_LEAF and its symbol, and an interior node's is the
+// index of its left child, with the right child next to it.
+//
+// The dump lists children before their parent, so the right child of
+// the node at i in the dump is at i - 1, and only the left one is kept,
+// in links, until the tree is laid out breadth first from the root.
+// Nothing is allocated and no Node is made.
 //
 // Input parameters:
-// root: Node **: Root * for the tree to be deleted
-// Returns: void
-void delete_tree(Node **root) {
-    if (*root == NULL) {
-        return;
+// nbytes: uint16_t: Size of the dump
+// tree: uint8_t []: The dump
+// packed: uint16_t []: Storage for the packed tree
+// Returns: bool: false if the dump is malformed, true otherwise
+bool pack_tree(uint16_t nbytes, const uint8_t tree[static nbytes], uint16_t packed[static MAX_NODES]) {
+    uint16_t links[MAX_NODES], order[MAX_NODES], stack[ALPHABET];
+    uint32_t top = 0, used = 0, tail = 1;
+    bool seen[ALPHABET] = { false };
+
+    if (nbytes > MAX_TREE_SIZE) {
+        return false;
     }
 
-    if ((*root)->left != NULL) {
-        delete_tree(&((*root)->left));
+    for (uint16_t i = 0; i < nbytes; i++) {
+        if (tree[i] == 'L' && i + 1 < nbytes) { // Leaf node
+            i += 1;
+            if (seen[tree[i]] || top == ALPHABET) {
+                return false;
+            }
+            seen[tree[i]] = true;
+            links[used] = PACKED_LEAF | tree[i];
+        } else if (tree[i] == 'I' && top >= 2) { // Interior node
+            top -= 2;
+            links[used] = stack[top];
+        } else {
+            return false;
+        }
+        stack[top++] = (uint16_t) used;
+        used += 1;
     }
-    if ((*root)->right != NULL) {
-        delete_tree(&((*root)->right));
+    if (top != 1) {
+        return false;
     }
-    node_delete(root);
 
-    return;
-}
+    order[0] = stack[0];
+    for (uint32_t head = 0; head < tail; head++) {
+        uint16_t node = order[head];
 
-// Debug function to print the tree. I used it to debug some issues I
-// was getting during decode.
-//
-// Input parameters:
-// root: Node **: Root * for the tree to be deleted
-// Returns: void
-void print_tree(Node *node) {
-    if (node == NULL) {
-        return;
-    }
-    if (node->left != NULL) {
-        print_tree(node->left);
-    }
-    if (node->right != NULL) {
-        print_tree(node->right);
+        if (links[node] & PACKED_LEAF) {
+            packed[head] = links[node];
+        } else {
+            packed[head] = (uint16_t) tail;
+            order[tail++] = links[node];
+            order[tail++] = node - 1;
+        }
     }
-    printf("%c\n", node->symbol);
-    return;
+    return true;
 }
@@ -3,14 +3,21 @@
 #include "code.h"
 #include "defines.h"
 #include "node.h"
+#include <stdbool.h>
 #include <stdint.h>
 
-Node *build_tree(uint64_t hist[static ALPHABET]);
+#define PACKED_LEAF 0x8000 // Marks a leaf in a packed tree, above its symbol.
+
+Node *build_tree(uint64_t hist[static ALPHABET], Node nodes[static MAX_NODES]);
 
 void build_codes(Node *root, Code table[static ALPHABET]);
 
+uint64_t coded_bits(uint64_t hist[static ALPHABET], Code table[static ALPHABET]);
+
+uint16_t flatten_tree(Node *root, uint8_t *buf);
+
 void dump_tree(int outfile, Node *root);
 
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]);
+Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes], Node nodes[static MAX_NODES]);
 
-void delete_tree(Node **root);
+bool pack_tree(uint16_t nbytes, const uint8_t tree[static nbytes], uint16_t packed[static MAX_NODES]);
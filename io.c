@@ -1,18 +1,12 @@
+#define _GNU_SOURCE
 #include "io.h"
 #include "code.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
-// Remove these includes later. Added for debugging an error
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-
-static uint8_t code_buf[BLOCK] = { 0 };
-static int code_index = 0;
-
 // Used to read the contents from infile. We create a wrapper around
 // the read() system call, that loops till the desired number of
 // bytes (nbytes) are read.
@@ -28,13 +22,13 @@ int read_bytes(int infile, uint8_t *buf, int nbytes) {
     // Initialize the buffer to 0 to ensure that if the amount of
     // data read is less than the buffer size, histogram is
     // not corrupted.
-    memset(buf, 0, BLOCK);
+    memset(buf, 0, nbytes);
 
     while (bytes_read < nbytes) {
         ssize_t num_bytes = read(infile, buf + bytes_read, nbytes - bytes_read);
 
-        if (num_bytes == 0) {
-            // End of file
+        if (num_bytes <= 0) {
+            // End of file, or an error
             break;
         }
 
@@ -58,8 +52,8 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes) {
     while (bytes_written < nbytes) {
         ssize_t num_bytes = write(outfile, buf + bytes_written, nbytes - bytes_written);
 
-        if (num_bytes == 0) {
-            // End of file
+        if (num_bytes <= 0) {
+            // End of file, or an error
             break;
         }
 
@@ -68,75 +62,175 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes) {
     return bytes_written;
 }
 
-// Read a block of bytes from infile into a buffer, and dole out one
-// bit at a time, till all bits have been doled out.
+// Set up a BitReader that reads at most nbytes from infile.
 //
 // Input parameters:
+// r: BitReader *: Reader to set up
 // infile: int: File descriptor of the file to be read
-// bit: uint8_t *: doled out bit
-// Returns: bool: false if there are no more bits to be read, true otherwise.
-bool read_bit(int infile, uint8_t *bit) {
-    static uint8_t buf[BLOCK];
-    static int num_bytes = 0;
-    static int byte_index = 0;
-    static int bit_index = 0;
-
-    // We want to read BLOCK number of bytes, and dole out one bit at
-    // a time. To ensure we don't read into buf each time we enter
-    // the function, we add this check.
-    if (num_bytes == 0 || byte_index == num_bytes) {
-        num_bytes = read_bytes(infile, buf, BLOCK);
-        byte_index = 0;
-        bit_index = 0;
-        if (num_bytes == 0) {
-            return false;
-        }
-    }
-    *bit = (buf[byte_index] & (0x1 << (bit_index & 0x7))) >> bit_index;
-    bit_index += 1;
+// nbytes: uint64_t: Number of coded bytes that follow
+// Returns: void
+void bit_reader_init(BitReader *r, int infile, uint64_t nbytes) {
+    r->bits = 0;
+    r->count = 0;
+    r->pad_bits = 0;
+    r->pos = 0;
+    r->len = 0;
+    r->limit = nbytes;
+    r->fd = infile;
+    return;
+}
 
-    // Reset at the end of each byte
-    if (bit_index == 8) {
-        bit_index = 0;
-        byte_index += 1;
-    }
-    return true;
+// Read the next BLOCK of coded bytes, staying within the reader's limit.
+// After the end of the input, len stays at 0.
+//
+// Input parameters:
+// r: BitReader *: Reader whose buffer is empty
+// Returns: void
+void bit_reader_fill(BitReader *r) {
+    int nbytes = r->limit < BLOCK ? (int) r->limit : BLOCK;
+
+    r->len = nbytes > 0 ? read_bytes(r->fd, r->buf, nbytes) : 0;
+    r->limit -= r->len;
+    r->pos = 0;
+    return;
 }
 
-// Write bits from Code c into a buffer. Once the buffer is full, it
-// will be writeen to the outfile.
+// Check whether more bits were consumed than the input held. That only
+// happens when the coded bits are corrupted or cut short.
 //
 // Input parameters:
+// r: BitReader *: Reader to check
+// Returns: bool: true if padding bits were consumed, false otherwise
+bool bit_reader_overrun(BitReader *r) {
+    return r->count < r->pad_bits;
+}
+
+// Set up a BitWriter with an empty buffer.
+//
+// Input parameters:
+// w: BitWriter *: Writer to set up
 // outfile: int: File descriptor of the file to be written
+// Returns: void
+void bit_writer_init(BitWriter *w, int outfile) {
+    w->fd = outfile;
+    w->index = 0;
+    w->failed = false;
+    memset(w->buf, 0, BLOCK);
+    return;
+}
+
+// Write bits from Code c into the writer's buffer. Once the buffer is
+// full, it will be written to the writer's file.
+//
+// Input parameters:
+// w: BitWriter *: Writer to add the bits to
 // c: Code *: Code to be written to the buffer
 // Returns: void
-void write_code(int outfile, Code *c) {
-    // Read bits from the code c into the static buffer
+void write_code(BitWriter *w, Code *c) {
+    // Read bits from the code c into the buffer
     for (uint32_t i = 0; i < code_size(c); i++) {
         if (code_get_bit(c, i) == true) {
-            code_buf[code_index >> 3] |= 0xff & (1 << (code_index & 0x7));
-        } else {
-            code_buf[code_index >> 3] |= 0xff & (0 << (code_index & 0x7));
+            w->buf[w->index >> 3] |= 0xff & (1 << (w->index & 0x7));
+        }
+        w->index += 1;
+
+        // index counts bits, so the buffer is full after
+        // BLOCK * 8 of them.
+        if (w->index == BLOCK * 8) {
+            w->failed |= write_bytes(w->fd, w->buf, BLOCK) != BLOCK;
+            w->index = 0;
+            memset(w->buf, 0, BLOCK);
         }
-        code_index += 1;
+    }
+    return;
+}
 
-        if (code_index == BLOCK) {
-            write_bytes(outfile, code_buf, BLOCK);
-            code_index = 0;
-            memset(code_buf, 0, BLOCK);
+// Write the lowest n bits of bits into the writer's buffer, lowest bit
+// first, the same order write_code() uses. Once the buffer is full, it
+// will be written to the writer's file.
+//
+// Input parameters:
+// w: BitWriter *: Writer to add the bits to
+// bits: uint64_t: Bits to be written to the buffer
+// n: uint32_t: Number of bits to write
+// Returns: void
+void write_bits(BitWriter *w, uint64_t bits, uint32_t n) {
+    while (n > 0) {
+        uint32_t used = w->index & 0x7;
+        uint32_t take = 8 - used < n ? 8 - used : n;
+
+        w->buf[w->index >> 3] |= (uint8_t) ((bits & ((1u << take) - 1)) << used);
+        bits >>= take;
+        n -= take;
+        w->index += take;
+        if (w->index == BLOCK * 8) {
+            w->failed |= write_bytes(w->fd, w->buf, BLOCK) != BLOCK;
+            w->index = 0;
+            memset(w->buf, 0, BLOCK);
         }
     }
     return;
 }
 
-// Write out any leftover, buffered bits. Since code_buf is initialized
+// Write out any leftover, buffered bits. Since the buffer is initialized
 // to 0, and is reset after being written, the extra bits should already
-// be zeroed out.
+// be zeroed out. The last, partially filled byte is written as well.
+// Whether every write went through is left in w->failed.
 //
 // Input parameters:
-// outfile: int
+// w: BitWriter *: Writer to flush
 // Returns: void
-void flush_codes(int outfile) {
-    write_bytes(outfile, code_buf, code_index >> 3);
+void flush_codes(BitWriter *w) {
+    int nbytes = (int) ((w->index + 7) >> 3);
+
+    w->failed |= write_bytes(w->fd, w->buf, nbytes) != nbytes;
+    memset(w->buf, 0, BLOCK);
+    w->index = 0;
     return;
 }
+
+// Copy nbytes from infile to outfile without bringing them into user
+// space. copy_file_range() handles regular files, and splice() handles
+// the case where either side is a pipe. Whatever neither of them can
+// move is copied through a buffer. Fewer than nbytes are copied if the
+// input ends or a write comes up short.
+//
+// Input parameters:
+// infile: int: File descriptor to copy from
+// outfile: int: File descriptor to copy to
+// nbytes: uint64_t: Number of bytes to copy
+// Returns: uint64_t: Number of bytes copied
+uint64_t copy_bytes(int infile, int outfile, uint64_t nbytes) {
+    uint64_t copied = 0;
+    uint8_t buf[BLOCK];
+    ssize_t n;
+
+    while (copied < nbytes) {
+        n = copy_file_range(infile, NULL, outfile, NULL, nbytes - copied, 0);
+        if (n <= 0) {
+            break;
+        }
+        copied += n;
+    }
+
+    while (copied < nbytes) {
+        n = splice(infile, NULL, outfile, NULL, nbytes - copied, SPLICE_F_MOVE);
+        if (n <= 0) {
+            break;
+        }
+        copied += n;
+    }
+
+    while (copied < nbytes) {
+        int chunk = nbytes - copied < BLOCK ? (int) (nbytes - copied) : BLOCK;
+
+        if ((n = read_bytes(infile, buf, chunk)) == 0) {
+            break;
+        }
+        if (write_bytes(outfile, buf, n) != n) {
+            break;
+        }
+        copied += n;
+    }
+    return copied;
+}
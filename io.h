@@ -1,18 +1,102 @@
 #pragma once
 
 #include "code.h"
+#include "defines.h"
 #include <stdbool.h>
 #include <stdint.h>
 
-extern uint64_t bytes_read;
-extern uint64_t bytes_written;
+// Reads coded bits from a file descriptor into a 64-bit buffer, with the
+// next bit to be decoded in the lowest position. Once the input runs out,
+// zero bits are shifted in and counted in pad_bits, so that readers can
+// peek ahead freely and check for an overrun afterwards.
+typedef struct {
+    uint64_t bits;
+    uint32_t count;
+    uint32_t pad_bits;
+    uint32_t pos;
+    uint32_t len;
+    uint64_t limit;
+    int fd;
+    uint8_t buf[BLOCK];
+} BitReader;
+
+// Collects coded bits, lowest bit of each byte first, and writes them
+// to its file BLOCK bytes at a time. If a write comes up short, failed
+// is set, and stays set till the writer is set up again.
+typedef struct {
+    uint32_t index;
+    int fd;
+    bool failed;
+    uint8_t buf[BLOCK];
+} BitWriter;
 
 int read_bytes(int infile, uint8_t *buf, int nbytes);
 
 int write_bytes(int outfile, uint8_t *buf, int nbytes);
 
-bool read_bit(int infile, uint8_t *bit);
+void bit_writer_init(BitWriter *w, int outfile);
+
+void write_code(BitWriter *w, Code *c);
+
+void write_bits(BitWriter *w, uint64_t bits, uint32_t n);
+
+void flush_codes(BitWriter *w);
+
+void bit_reader_init(BitReader *r, int infile, uint64_t nbytes);
+
+void bit_reader_fill(BitReader *r);
+
+bool bit_reader_overrun(BitReader *r);
+
+// Top up the bit buffer so that it holds at least 57 bits. Inlined, since
+// the decode loops call it for every few symbols.
+//
+// Input parameters:
+// r: BitReader *: Reader to refill
+// Returns: void
+static inline void bit_reader_refill(BitReader *r) {
+    while (r->count <= 56) {
+        if (r->pos == r->len) {
+            bit_reader_fill(r);
+        }
+        if (r->pos < r->len) {
+            r->bits |= (uint64_t) r->buf[r->pos++] << r->count;
+        } else {
+            r->pad_bits += 8;
+        }
+        r->count += 8;
+    }
+    return;
+}
+
+uint64_t copy_bytes(int infile, int outfile, uint64_t nbytes);
+
+// Store the lowest nbytes bytes of value at buf, lowest byte first, as
+// every integer in an encoded file is.
+//
+// Input parameters:
+// buf: uint8_t *: Where to store the bytes
+// value: uint64_t: Value to store
+// nbytes: uint32_t: Number of bytes, at most 8
+// Returns: void
+static inline void store_le(uint8_t *buf, uint64_t value, uint32_t nbytes) {
+    for (uint32_t i = 0; i < nbytes; i++) {
+        buf[i] = (uint8_t) (value >> (8 * i));
+    }
+    return;
+}
 
-void write_code(int outfile, Code *c);
+// Load nbytes bytes stored by store_le().
+//
+// Input parameters:
+// buf: const uint8_t *: Where the bytes are stored
+// nbytes: uint32_t: Number of bytes, at most 8
+// Returns: uint64_t: The value they hold
+static inline uint64_t load_le(const uint8_t *buf, uint32_t nbytes) {
+    uint64_t value = 0;
 
-void flush_codes(int outfile);
+    for (uint32_t i = 0; i < nbytes; i++) {
+        value |= (uint64_t) buf[i] << (8 * i);
+    }
+    return value;
+}
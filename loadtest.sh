@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Load test for huffd. Starts a daemon on a private socket, then runs
+# CLIENTS copies of huffc in parallel, each sending REQUESTS compress
+# requests for FILE over one connection, and reports the throughput.
+# The last result is decompressed again and compared with FILE.
+#
+# Usage: ./loadtest.sh [FILE] [CLIENTS] [REQUESTS]
+
+FILE=${1:-input_text}
+CLIENTS=${2:-8}
+REQUESTS=${3:-100}
+DIR=$(mktemp -d)
+SOCK=$DIR/huffd.sock
+
+./huffd -s "$SOCK" &
+DAEMON=$!
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+
+# Wait for the daemon to start listening.
+for i in $(seq 1 50); do
+    [ -S "$SOCK" ] && break
+    sleep 0.1
+done
+
+START=$(date +%s.%N)
+for i in $(seq 1 "$CLIENTS"); do
+    ./huffc -s "$SOCK" -r "$REQUESTS" -i "$FILE" -o "$DIR/out.$i" &
+done
+wait $(jobs -p | grep -v "^$DAEMON$")
+END=$(date +%s.%N)
+
+./huffc -s "$SOCK" -d -i "$DIR/out.1" -o "$DIR/check" || exit 1
+cmp -s "$FILE" "$DIR/check" || { echo "Round trip through huffd failed"; exit 1; }
+
+SIZE=$(stat -c %s "$FILE")
+awk -v s="$START" -v e="$END" -v n=$((CLIENTS * REQUESTS)) -v b="$SIZE" 'BEGIN {
+    t = e - s
+    printf "%d requests in %.3f s: %.0f requests/s, %.1f MB/s\n", n, t, n / t, n * b / t / 1e6
+}'
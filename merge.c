@@ -0,0 +1,80 @@
+#include "histogram.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Usage Function
+// Input parameters:
+// exec_name: char *: Name of the program
+// Returns: void
+void usage(char *exec_name) {
+    printf("USAGE: %s [-o <outfile>][-h] <histogram>...\n", exec_name);
+    printf("<histogram>: Histogram file written by encode --histogram-only\n");
+    printf("-o <outfile>: File to write the summed histogram to. Default is stdout\n");
+    printf("-h: Print this message\n");
+    return;
+}
+
+// The main function. Sums the counts in every histogram file given, such
+// as those of the shards of one dataset, into one histogram file, for
+// encode --use-histogram to build a tree for all of them from.
+//
+// Input parameters:
+// argc: int: Number of input arguments
+// argv: char **: The input arguments
+// Returns: int: 0 in case of success, non-zero for failure
+int main(int argc, char **argv) {
+    int opt;
+    char *outfile = NULL;
+    uint64_t sum[ALPHABET] = { 0 };
+    uint64_t hist[ALPHABET];
+    int ofd = 1;
+
+    // Parse the input options.
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+        case ('o'): outfile = optarg; break;
+        case ('h'): usage(argv[0]); return 0;
+        default: usage(argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = optind; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        bool loaded;
+
+        if (fd == -1) {
+            fprintf(stderr, "Unable to open %s for reading\n", argv[i]);
+            return 1;
+        }
+        loaded = histogram_load(fd, hist);
+        close(fd);
+        if (loaded == false) {
+            fprintf(stderr, "%s is not a histogram file\n", argv[i]);
+            return 1;
+        }
+        if (histogram_add(sum, hist) == false) {
+            fprintf(stderr, "The counts overflow when %s is added\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (outfile != NULL && (ofd = open(outfile, O_CREAT | O_WRONLY | O_TRUNC, 0644)) == -1) {
+        fprintf(stderr, "Error opening output file\n");
+        return 1;
+    }
+    if (histogram_save(ofd, sum) == false) {
+        fprintf(stderr, "Unable to write the histogram\n");
+        return 1;
+    }
+    if (ofd != 1) {
+        close(ofd);
+    }
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include "perf.h"
+
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// The perf_event_open() type and config of each PerfEvent, and the name
+// it is reported under.
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} events[PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+    { PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        "L1D-misses" },
+    { PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        "LLC-misses" },
+};
+
+static const char *stage_names[PERF_STAGES] = { "histogram", "tree", "input", "code", "output" };
+
+// The monotonic clock in nanoseconds.
+//
+// Returns: uint64_t: Nanoseconds since some fixed point
+static uint64_t now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// Open a counter for the calling thread, in user space only, so that it
+// works at the default perf_event_paranoid setting.
+//
+// Input parameters:
+// type: uint32_t: perf_event_open() type of the event
+// config: uint64_t: perf_event_open() config of the event
+// group: int: Group leader to join, or -1 to lead a new group
+// Returns: int: File descriptor of the counter, -1 if it is unavailable
+static int open_event(uint32_t type, uint64_t config, int group) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Open the counters for the calling thread, and start them. Nothing is
+// attributed to a stage until perf_enter() is first called.
+//
+// Returns: PerfCounters *: The counters, with num_open 0 if there are none
+PerfCounters *perf_create(void) {
+    PerfCounters *p = (PerfCounters *) calloc(1, sizeof(PerfCounters));
+
+    p->leader = -1;
+    for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+        p->fds[i] = open_event(events[i].type, events[i].config, p->leader);
+        if (p->fds[i] != -1) {
+            if (p->leader == -1) {
+                p->leader = p->fds[i];
+            }
+            p->slots[i] = p->num_open++;
+        }
+    }
+    if (p->leader != -1) {
+        ioctl(p->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    return p;
+}
+
+// Close the counters.
+//
+// Input parameters:
+// p: PerfCounters **: Counters to close
+// Returns: void
+void perf_delete(PerfCounters **p) {
+    for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+        if ((*p)->fds[i] != -1) {
+            close((*p)->fds[i]);
+        }
+    }
+    free(*p);
+    *p = NULL;
+    return;
+}
+
+// Read the whole group at once, so that the counts agree with each other.
+//
+// Input parameters:
+// p: PerfCounters *: Counters to read
+// counts: uint64_t []: Filled in with the count of each open event
+// Returns: void
+static void read_counts(PerfCounters *p, uint64_t counts[static PERF_EVENTS]) {
+    uint64_t buf[1 + PERF_EVENTS] = { 0 };
+
+    memset(counts, 0, PERF_EVENTS * sizeof(uint64_t));
+    if (p->leader == -1 || read(p->leader, buf, sizeof(buf)) <= 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+        if (p->fds[i] != -1 && p->slots[i] < buf[0]) {
+            counts[i] = buf[1 + p->slots[i]];
+        }
+    }
+    return;
+}
+
+// Add the counts and time since the last switch to the current stage,
+// and carry on counting for stage, if running.
+//
+// Input parameters:
+// p: PerfCounters *: Counters to switch
+// stage: PerfStage: Stage to count for next
+// running: bool: Whether to count anything until the next switch
+// Returns: void
+static void perf_switch(PerfCounters *p, PerfStage stage, bool running) {
+    uint64_t counts[PERF_EVENTS];
+    uint64_t t;
+
+    read_counts(p, counts);
+    t = now();
+    if (p->running == true) {
+        for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+            p->counts[p->stage][i] += counts[i] - p->last[i];
+        }
+        p->nanos[p->stage] += t - p->last_nanos;
+    }
+    memcpy(p->last, counts, sizeof(p->last));
+    p->last_nanos = t;
+    p->stage = stage;
+    p->running = running;
+    return;
+}
+
+// Attribute what happens from here on to stage, until the next call.
+// Does nothing when p is NULL, so that the pipelines can call it freely.
+//
+// Input parameters:
+// p: PerfCounters *: Counters, or NULL
+// stage: PerfStage: Stage being entered
+// Returns: void
+void perf_enter(PerfCounters *p, PerfStage stage) {
+    if (p != NULL) {
+        perf_switch(p, stage, true);
+    }
+    return;
+}
+
+// Stop attributing to any stage, until perf_enter() is called again.
+//
+// Input parameters:
+// p: PerfCounters *: Counters, or NULL
+// Returns: void
+void perf_stop(PerfCounters *p) {
+    if (p != NULL) {
+        perf_switch(p, p->stage, false);
+    }
+    return;
+}
+
+// Print a line of the report: the time and throughput of a stage, and
+// its IPC and events per byte where the counters are open.
+//
+// Input parameters:
+// p: PerfCounters *: Counters being reported
+// name: const char *: Name of the stage
+// counts: uint64_t []: Counts of the stage
+// nanos: uint64_t: Time spent in the stage
+// nbytes: uint64_t: Bytes the whole run processed
+// out: FILE *: Where to print
+// Returns: void
+static void report_line(PerfCounters *p, const char *name, uint64_t counts[static PERF_EVENTS], uint64_t nanos, uint64_t nbytes, FILE *out) {
+    double bytes = nbytes > 0 ? (double) nbytes : 1;
+
+    fprintf(out, "%-10s %10.3f %10.1f", name, nanos / 1e6, nanos > 0 ? bytes * 1e3 / nanos : 0);
+    if (p->num_open == 0) {
+        fprintf(out, "\n");
+        return;
+    }
+    if (p->fds[PERF_CYCLES] != -1 && p->fds[PERF_INSTRUCTIONS] != -1 && counts[PERF_CYCLES] > 0) {
+        fprintf(out, " %6.2f", (double) counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES]);
+    } else {
+        fprintf(out, " %6s", "-");
+    }
+    for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+        if (i == PERF_INSTRUCTIONS) {
+            continue;
+        }
+        if (p->fds[i] != -1) {
+            fprintf(out, " %15.4f", counts[i] / bytes);
+        } else {
+            fprintf(out, " %15s", "-");
+        }
+    }
+    fprintf(out, "\n");
+    return;
+}
+
+// Stop counting, and print the time, throughput, IPC and events per byte
+// of each stage that ran, and of all of them together. Without counters,
+// only the times are printed.
+//
+// Input parameters:
+// p: PerfCounters *: Counters to report, or NULL
+// nbytes: uint64_t: Bytes the run processed, that the events are divided by
+// out: FILE *: Where to print
+// Returns: void
+void perf_report(PerfCounters *p, uint64_t nbytes, FILE *out) {
+    uint64_t total[PERF_EVENTS] = { 0 };
+    uint64_t total_nanos = 0;
+
+    if (p == NULL) {
+        return;
+    }
+    perf_stop(p);
+    if (p->num_open == 0) {
+        fprintf(out, "Hardware counters are unavailable, so only timings are reported\n");
+    }
+    fprintf(out, "%-10s %10s %10s", "stage", "ms", "MB/s");
+    if (p->num_open > 0) {
+        fprintf(out, " %6s", "IPC");
+        for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+            if (i != PERF_INSTRUCTIONS) {
+                fprintf(out, " %13s/B", events[i].name);
+            }
+        }
+    }
+    fprintf(out, "\n");
+    for (uint32_t s = 0; s < PERF_STAGES; s++) {
+        if (p->nanos[s] == 0) {
+            continue;
+        }
+        report_line(p, stage_names[s], p->counts[s], p->nanos[s], nbytes, out);
+        for (uint32_t i = 0; i < PERF_EVENTS; i++) {
+            total[i] += p->counts[s][i];
+        }
+        total_nanos += p->nanos[s];
+    }
+    report_line(p, "total", total, total_nanos, nbytes, out);
+    return;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Stages of the encode and decode pipelines that counts are kept for.
+typedef enum {
+    PERF_HISTOGRAM, // Counting the input.
+    PERF_TREE, // Building or rebuilding a tree and its tables.
+    PERF_INPUT, // Reading the input to code.
+    PERF_CODE, // Coding or decoding symbols.
+    PERF_OUTPUT, // Checksumming and writing decoded output.
+    PERF_STAGES,
+} PerfStage;
+
+// Hardware events counted for each stage.
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_EVENTS,
+} PerfEvent;
+
+// Hardware counters for the calling thread, opened as one group so that
+// they are read together, and the counts and time of each stage. Events
+// the CPU or kernel does not offer are left out, and with none at all
+// only the time is kept.
+typedef struct {
+    int leader;
+    int fds[PERF_EVENTS];
+    uint32_t slots[PERF_EVENTS]; // Position of each event in a group read.
+    uint32_t num_open;
+    uint64_t last[PERF_EVENTS];
+    uint64_t last_nanos;
+    PerfStage stage; // Stage that the counts since the last switch go to.
+    bool running;
+    uint64_t counts[PERF_STAGES][PERF_EVENTS];
+    uint64_t nanos[PERF_STAGES];
+} PerfCounters;
+
+PerfCounters *perf_create(void);
+
+void perf_delete(PerfCounters **p);
+
+void perf_enter(PerfCounters *p, PerfStage stage);
+
+void perf_stop(PerfCounters *p);
+
+void perf_report(PerfCounters *p, uint64_t nbytes, FILE *out);
@@ -0,0 +1,251 @@
+#include "planner.h"
+#include "checksum.h"
+#include "header.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A segment of the input waiting for the planner to decide which block
+// it goes in.
+typedef struct {
+    uint8_t data[PLAN_SEGMENT];
+    uint32_t size;
+    uint64_t histogram[ALPHABET];
+} Segment;
+
+struct Planner {
+    int ifd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    PlannedBlock queue[PLAN_QUEUE];
+    uint32_t head, size;
+    bool done;
+    uint32_t crc; // CRC32C of the whole input, once done.
+    uint32_t segment; // Size of each segment.
+    uint32_t lookahead; // Segments in the window.
+    Segment window[PLAN_MAX_LOOKAHEAD];
+    PlannedBlock cur; // Block being built.
+};
+
+// Estimate the size a block with histogram h codes to: the entropy of
+// its bytes, plus its tree dump and block header.
+//
+// Input parameters:
+// h: uint64_t *: Histogram of the block
+// Returns: double: Estimated size in bytes
+static double block_cost(uint64_t h[static ALPHABET]) {
+    uint64_t total = 0;
+    uint32_t symbols = 0;
+    double bits = 0;
+
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        if (h[i] != 0) {
+            total += h[i];
+            symbols += 1;
+            bits -= h[i] * log2((double) h[i]);
+        }
+    }
+    if (total == 0) {
+        return 0;
+    }
+    bits += total * log2((double) total);
+    return bits / 8 + 3 * symbols - 1 + BLOCK_HEADER_SIZE;
+}
+
+// Add histogram b into a.
+//
+// Input parameters:
+// a: uint64_t *: Histogram to add to
+// b: uint64_t *: Histogram to add
+// Returns: void
+static void add_histogram(uint64_t a[static ALPHABET], uint64_t b[static ALPHABET]) {
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        a[i] += b[i];
+    }
+    return;
+}
+
+// Hand a planned block over to the encoder, waiting while the queue is
+// full.
+//
+// Input parameters:
+// p: Planner *: Planner whose queue to push onto
+// b: PlannedBlock *: Block to push
+// Returns: void
+static void push_block(Planner *p, PlannedBlock *b) {
+    pthread_mutex_lock(&p->lock);
+    while (p->size == PLAN_QUEUE) {
+        pthread_cond_wait(&p->space, &p->lock);
+    }
+    p->queue[(p->head + p->size) % PLAN_QUEUE] = *b;
+    p->size += 1;
+    pthread_cond_signal(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
+
+// The planner thread. It reads the input a segment at a time, keeping
+// up to p->lookahead of them in a window, and then decides whether
+// the oldest one joins the block being built or starts a new one. A new
+// block is started when the window costs less coded on its own than
+// added to the current block, so that a boundary is only placed where
+// the content stays changed for the whole window, and never for a
+// single odd segment. Only the window is held in memory, however large
+// the input.
+//
+// Input parameters:
+// arg: void *: The Planner
+// Returns: void *: NULL
+static void *plan_blocks(void *arg) {
+    Planner *p = (Planner *) arg;
+    PlannedBlock *cur = &p->cur;
+    uint64_t ahead[ALPHABET], both[ALPHABET];
+    uint64_t offset = 0;
+    uint32_t first = 0, count = 0;
+    bool eof = false;
+
+    p->crc = 0;
+    while (true) {
+        // Fill the window.
+        while (count < p->lookahead && eof == false) {
+            Segment *s = &p->window[(first + count) % p->lookahead];
+            ssize_t n = pread(p->ifd, s->data, p->segment, (off_t) (offset + count * p->segment));
+
+            if (n <= 0) {
+                eof = true;
+                break;
+            }
+            s->size = (uint32_t) n;
+            memset(s->histogram, 0, sizeof(s->histogram));
+            for (ssize_t i = 0; i < n; i++) {
+                s->histogram[s->data[i]] += 1;
+            }
+            count += 1;
+            eof = n < p->segment;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        // Decide where the oldest segment goes.
+        if (cur->size != 0) {
+            memset(ahead, 0, sizeof(ahead));
+            for (uint32_t i = 0; i < count; i++) {
+                add_histogram(ahead, p->window[(first + i) % p->lookahead].histogram);
+            }
+            memcpy(both, cur->histogram, sizeof(both));
+            add_histogram(both, ahead);
+            if (block_cost(cur->histogram) + block_cost(ahead) < block_cost(both)) {
+                push_block(p, cur);
+                memset(cur, 0, sizeof(PlannedBlock));
+                cur->offset = offset;
+            }
+        }
+
+        Segment *s = &p->window[first];
+        add_histogram(cur->histogram, s->histogram);
+        cur->crc = crc32c(cur->crc, s->data, s->size);
+        cur->size += s->size;
+        p->crc = crc32c(p->crc, s->data, s->size);
+        offset += s->size;
+        first = (first + 1) % p->lookahead;
+        count -= 1;
+    }
+    if (cur->size != 0) {
+        push_block(p, cur);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->done = true;
+    pthread_cond_signal(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Start planning the blocks of ifd, from its start, in a thread of its
+// own. ifd is only read with pread(), so the caller is free to use its
+// offset meanwhile. Smaller segments let boundaries fall closer to where
+// the content changes, and a longer lookahead keeps short changes from
+// splitting a block; PLAN_SEGMENT and PLAN_LOOKAHEAD are the defaults.
+//
+// Input parameters:
+// ifd: int: File descriptor of the file to plan
+// segment: uint32_t: Size of the segments blocks are made of, at most PLAN_SEGMENT
+// lookahead: uint32_t: Segments to look ahead, at most PLAN_MAX_LOOKAHEAD
+// Returns: Planner *: The running planner, NULL if it could not start
+Planner *planner_create(int ifd, uint32_t segment, uint32_t lookahead) {
+    Planner *p;
+
+    if (segment == 0 || segment > PLAN_SEGMENT || lookahead == 0 || lookahead > PLAN_MAX_LOOKAHEAD) {
+        return NULL;
+    }
+    if ((p = (Planner *) calloc(1, sizeof(Planner))) == NULL) {
+        return NULL;
+    }
+    p->ifd = ifd;
+    p->segment = segment;
+    p->lookahead = lookahead;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->ready, NULL);
+    pthread_cond_init(&p->space, NULL);
+    if (pthread_create(&p->thread, NULL, plan_blocks, p) != 0) {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+// Wait for the next planned block.
+//
+// Input parameters:
+// p: Planner *: Running planner
+// b: PlannedBlock *: Filled in with the next block
+// Returns: bool: false once every block has been handed out, true otherwise
+bool planner_next(Planner *p, PlannedBlock *b) {
+    bool ok = false;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->size == 0 && p->done == false) {
+        pthread_cond_wait(&p->ready, &p->lock);
+    }
+    if (p->size > 0) {
+        *b = p->queue[p->head];
+        p->head = (p->head + 1) % PLAN_QUEUE;
+        p->size -= 1;
+        pthread_cond_signal(&p->space);
+        ok = true;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+// The CRC32C of the whole input. Only valid once planner_next() has
+// returned false.
+//
+// Input parameters:
+// p: Planner *: Finished planner
+// Returns: uint32_t: CRC32C of the input
+uint32_t planner_crc(Planner *p) {
+    return p->crc;
+}
+
+// Wait for the planner thread to finish, and free the planner. Every
+// block must have been taken with planner_next() first.
+//
+// Input parameters:
+// p: Planner **: Planner to free
+// Returns: void
+void planner_delete(Planner **p) {
+    pthread_join((*p)->thread, NULL);
+    pthread_mutex_destroy(&(*p)->lock);
+    pthread_cond_destroy(&(*p)->ready);
+    pthread_cond_destroy(&(*p)->space);
+    free(*p);
+    *p = NULL;
+    return;
+}
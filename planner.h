@@ -0,0 +1,29 @@
+#pragma once
+
+#include "defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PLAN_SEGMENT       (16 * BLOCK) // Default, and largest, stretch of input a block is made of.
+#define PLAN_LOOKAHEAD     4 // Default segments looked at past a possible block boundary.
+#define PLAN_MAX_LOOKAHEAD 16 // Most segments the planner can look ahead.
+#define PLAN_QUEUE         4 // Planned blocks the planner can get ahead by.
+
+// A stretch of the input to be coded as one block, with the histogram
+// and CRC32C of its bytes.
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t histogram[ALPHABET];
+    uint32_t crc;
+} PlannedBlock;
+
+typedef struct Planner Planner;
+
+Planner *planner_create(int ifd, uint32_t segment, uint32_t lookahead);
+
+bool planner_next(Planner *p, PlannedBlock *b);
+
+uint32_t planner_crc(Planner *p);
+
+void planner_delete(Planner **p);
@@ -1,39 +1,19 @@
 #include "pq.h"
-#include "huffman.h"
-#include "node.h"
 
-#include <stdio.h>
-#include <stdlib.h>
+#include <stddef.h>
 
-struct PriorityQueue {
-    Node **nodes;
-    uint32_t size;
-    uint32_t capacity;
-};
-
-// Constructor function for the priority queue
+// Set up a queue in storage of the caller's, so that nothing is
+// allocated. The queue lives as long as nodes does.
 //
 // Input parameters:
+// q: PriorityQueue *: Queue to set up
+// nodes: Node **: Storage for capacity node pointers
 // capacity: uint32_t: Maximum capacity of the queue.
-// Returns: PriorityQueue *: Pointer to the pq created
-PriorityQueue *pq_create(uint32_t capacity) {
-    PriorityQueue *q = (PriorityQueue *) calloc(1, sizeof(PriorityQueue));
-    q->nodes = (Node **) calloc(capacity, sizeof(Node *));
+// Returns: void
+void pq_init(PriorityQueue *q, Node **nodes, uint32_t capacity) {
+    q->nodes = nodes;
     q->size = 0;
     q->capacity = capacity;
-
-    return q;
-}
-
-// Destructor function for the priority queue
-//
-// Input parameters:
-// q: PriorityQueue **: Pointer to the pq to be deleted
-// Returns: void
-void pq_delete(PriorityQueue **q) {
-    free((*q)->nodes);
-    free(*q);
-    *q = NULL;
     return;
 }
 
@@ -116,15 +96,3 @@ bool dequeue(PriorityQueue *q, Node **n) {
     q->size -= 1;
     return true;
 }
-
-// Debug function to print the pq.
-//
-// Input parameters:
-// q: PriorityQueue *: Ptr to the queue to be printed
-// Returns: void
-void pq_print(PriorityQueue *q) {
-    for (uint32_t i = 0; i < q->size; i++) {
-        printf("%u\t%ld\n", q->nodes[i]->symbol, q->nodes[i]->frequency);
-    }
-    return;
-}
@@ -6,9 +6,14 @@
 
 typedef struct PriorityQueue PriorityQueue;
 
-PriorityQueue *pq_create(uint32_t capacity);
+// Defined here so that a queue can live on the stack, with pq_init().
+struct PriorityQueue {
+    Node **nodes;
+    uint32_t size;
+    uint32_t capacity;
+};
 
-void pq_delete(PriorityQueue **q);
+void pq_init(PriorityQueue *q, Node **nodes, uint32_t capacity);
 
 bool pq_empty(PriorityQueue *q);
 
@@ -19,5 +24,3 @@ uint32_t pq_size(PriorityQueue *q);
 bool enqueue(PriorityQueue *q, Node *n);
 
 bool dequeue(PriorityQueue *q, Node **n);
-
-void pq_print(PriorityQueue *q);
@@ -0,0 +1,115 @@
+#include "rle.h"
+
+#include <string.h>
+
+// Set up the state for a new stream.
+//
+// Input parameters:
+// s: RleState *: State to set up
+// Returns: void
+void rle_init(RleState *s) {
+    s->last = 0;
+    s->run = 0;
+    s->count = 0;
+    s->pending = 0;
+    return;
+}
+
+// Run-length code nbytes from in. Bytes are copied through as they are,
+// but once the same byte has been copied RLE_MIN times in a row, the
+// next byte is a count of how many more copies were left out, up to
+// RLE_MAX. Input without runs stays the same size, and long runs shrink
+// to 5 bytes per RLE_MIN + RLE_MAX copies. A run still being counted
+// when in runs out is carried over to the next call.
+//
+// Input parameters:
+// s: RleState *: State carried over from the previous call
+// in: uint8_t *: Bytes to code
+// nbytes: int: Number of bytes in in
+// out: uint8_t *: Coded bytes, which must have room for 2 * nbytes
+// Returns: int: Number of bytes written to out
+int rle_encode(RleState *s, uint8_t *in, int nbytes, uint8_t *out) {
+    int o = 0;
+
+    for (int i = 0; i < nbytes; i++) {
+        uint8_t b = in[i];
+
+        if (s->run == RLE_MIN) {
+            if (b == s->last && s->count < RLE_MAX) {
+                s->count += 1;
+                continue;
+            }
+            out[o++] = (uint8_t) s->count;
+            s->run = 0;
+        }
+        if (s->run > 0 && b == s->last) {
+            s->run += 1;
+        } else {
+            s->last = b;
+            s->run = 1;
+        }
+        out[o++] = b;
+        s->count = 0;
+    }
+    return o;
+}
+
+// Write out the count of a run that was still being counted at the end
+// of the input.
+//
+// Input parameters:
+// s: RleState *: State after the last call to rle_encode()
+// out: uint8_t *: Coded bytes, which must have room for 1 byte
+// Returns: int: Number of bytes written to out
+int rle_finish(RleState *s, uint8_t *out) {
+    if (s->run == RLE_MIN) {
+        out[0] = (uint8_t) s->count;
+        s->run = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Undo rle_encode(), writing at most cap bytes to out. Since one input
+// byte can expand to RLE_MAX output bytes, this stops once out is full,
+// and the caller calls again with the rest of the input. It only returns
+// with out not full once all of the input is used and written out.
+//
+// Input parameters:
+// s: RleState *: State carried over from the previous call
+// in: uint8_t *: Coded bytes
+// nbytes: int: Number of bytes in in
+// out: uint8_t *: Decoded bytes
+// cap: int: Room in out
+// produced: int *: Set to the number of bytes written to out
+// Returns: int: Number of bytes used from in
+int rle_decode(RleState *s, uint8_t *in, int nbytes, uint8_t *out, int cap, int *produced) {
+    int i = 0, o = 0;
+
+    while (o < cap) {
+        if (s->pending > 0) {
+            int n = (int) s->pending < cap - o ? (int) s->pending : cap - o;
+            memset(out + o, s->last, n);
+            s->pending -= n;
+            o += n;
+            continue;
+        }
+        if (i == nbytes) {
+            break;
+        }
+        if (s->run == RLE_MIN) {
+            s->pending = in[i++];
+            s->run = 0;
+            continue;
+        }
+        if (s->run > 0 && in[i] == s->last) {
+            s->run += 1;
+        } else {
+            s->last = in[i];
+            s->run = 1;
+        }
+        out[o++] = in[i++];
+    }
+    *produced = o;
+    return i;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#define RLE_MIN 4 // Copies of a byte after which a run count follows.
+#define RLE_MAX 255 // Most extra copies a run count can give.
+
+// State carried from one buffer to the next, so that runs can span
+// buffers. The same state serves both directions.
+typedef struct {
+    uint8_t last; // Last literal byte.
+    uint32_t run; // Copies of it in a row, up to RLE_MIN.
+    uint32_t count; // Extra copies counted since the run reached RLE_MIN.
+    uint32_t pending; // Extra copies yet to be written out.
+} RleState;
+
+void rle_init(RleState *s);
+
+int rle_encode(RleState *s, uint8_t *in, int nbytes, uint8_t *out);
+
+int rle_finish(RleState *s, uint8_t *out);
+
+int rle_decode(RleState *s, uint8_t *in, int nbytes, uint8_t *out, int cap, int *produced);
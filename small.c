@@ -0,0 +1,475 @@
+#include "small.h"
+#include "checksum.h"
+#include "header.h"
+#include "io.h"
+
+#include <string.h>
+
+// Sort leaves, each a count above a symbol, by count. Counts are under
+// 2^16, so two passes of a radix sort on a byte of the count do it,
+// which costs far less than qsort() on so few leaves.
+//
+// Input parameters:
+// keys: uint32_t *: Leaves to sort
+// n: uint32_t: Number of leaves, at most ALPHABET
+// Returns: void
+static void sort_keys(uint32_t *keys, uint32_t n) {
+    uint32_t sorted[ALPHABET];
+
+    for (uint32_t shift = 8; shift < 24; shift += 8) {
+        uint32_t start[ALPHABET + 1] = { 0 };
+
+        for (uint32_t i = 0; i < n; i++) {
+            start[((keys[i] >> shift) & 0xff) + 1] += 1;
+        }
+        for (uint32_t b = 0; b < ALPHABET; b++) {
+            start[b + 1] += start[b];
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            sorted[start[(keys[i] >> shift) & 0xff]++] = keys[i];
+        }
+        memcpy(keys, sorted, n * sizeof(uint32_t));
+    }
+    return;
+}
+
+// Turn counts sorted in increasing order into code lengths, in place, as
+// Moffat and Katajainen do. The first pass joins the two smallest nodes
+// as the Huffman algorithm does, keeping the joined nodes at the front of
+// the array and pointing each at its parent once it is used. The second
+// pass turns the parent pointers into depths, and the third hands the
+// depths out to the leaves, deepest first. No memory is needed besides
+// the counts.
+//
+// Input parameters:
+// a: uint32_t *: Counts, sorted in increasing order, replaced by code lengths
+// n: int32_t: Number of counts, at least 2
+// Returns: void
+static void minimum_redundancy(uint32_t *a, int32_t n) {
+    int32_t root = 0, leaf = 2, next, avail, used, depth;
+
+    a[0] += a[1];
+    for (next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = (uint32_t) next;
+        } else {
+            a[next] = a[leaf++];
+        }
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = (uint32_t) next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--) {
+        a[next] = a[a[next]] + 1;
+    }
+
+    avail = 1;
+    used = depth = 0;
+    root = n - 2;
+    next = n - 1;
+    while (avail > 0) {
+        while (root >= 0 && a[root] == (uint32_t) depth) {
+            used++;
+            root--;
+        }
+        while (avail > used) {
+            a[next--] = (uint32_t) depth;
+            avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+    return;
+}
+
+// Build code lengths for the symbols of a histogram with at least two.
+// If the longest is over SMALL_MAX_LENGTH, the counts are halved, which
+// flattens the tree, till it fits, as wide_build() does.
+//
+// Input parameters:
+// hist: const uint32_t *: Count of each symbol
+// lengths: uint8_t *: Set to the code length of each symbol, 0 if it does not occur
+// Returns: void
+static void code_lengths(const uint32_t hist[static ALPHABET], uint8_t lengths[static ALPHABET]) {
+    uint32_t keys[ALPHABET], a[ALPHABET];
+    uint32_t n = 0;
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        lengths[s] = 0;
+        if (hist[s] != 0) {
+            keys[n++] = hist[s] << 8 | s;
+        }
+    }
+    sort_keys(keys, n);
+    for (;;) {
+        for (uint32_t i = 0; i < n; i++) {
+            a[i] = keys[i] >> 8;
+        }
+        minimum_redundancy(a, (int32_t) n);
+        if (a[0] <= SMALL_MAX_LENGTH) {
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            keys[i] = ((keys[i] >> 9 | 1) << 8) | (keys[i] & 0xff);
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        lengths[keys[i] & 0xff] = (uint8_t) a[i];
+    }
+    return;
+}
+
+// Reverse the lowest n bits of code, since codes are built first bit
+// highest but written first bit lowest.
+//
+// Input parameters:
+// code: uint32_t: Code to reverse
+// n: uint32_t: Length of the code
+// Returns: uint32_t: Reversed code
+static uint32_t reverse_bits(uint32_t code, uint32_t n) {
+    uint32_t rev = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        rev = (rev << 1) | ((code >> i) & 1);
+    }
+    return rev;
+}
+
+// Work out how an input with this histogram is coded, and its size. An
+// empty input is stored, with nothing to store, and one with a single
+// symbol is a run of it. Otherwise it is Huffman coded, unless that
+// would not come out smaller than the input.
+//
+// Input parameters:
+// hist: const uint32_t *: Count of each symbol
+// n: uint32_t: Size of the input
+// lengths: uint8_t *: Set to the code lengths if the input is Huffman coded
+// kind: uint8_t *: Set to SMALL_STORED, SMALL_RUN or SMALL_HUFFMAN
+// table_size: uint32_t *: Set to the size of the code table
+// coded_size: uint32_t *: Set to the size of the coded data
+// Returns: uint32_t: Size of the small object
+static uint32_t plan(const uint32_t hist[static ALPHABET], uint32_t n, uint8_t lengths[static ALPHABET], uint8_t *kind, uint32_t *table_size, uint32_t *coded_size) {
+    uint32_t used = 0, bits = 0;
+
+    *table_size = 0;
+    *coded_size = 0;
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        used += hist[s] != 0;
+    }
+    if (n == 0) {
+        *kind = SMALL_STORED;
+        return SMALL_HEADER_SIZE + TRAILER_SIZE;
+    }
+    if (used == 1) {
+        *kind = SMALL_RUN;
+        *coded_size = 1;
+        return SMALL_HEADER_SIZE + 1 + TRAILER_SIZE;
+    }
+
+    code_lengths(hist, lengths);
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        bits += hist[s] * lengths[s];
+    }
+    *table_size = ALPHABET / 8 + (used + 1) / 2 + 2;
+    *coded_size = (bits + 7) / 8;
+    if (*table_size + *coded_size >= n) {
+        *kind = SMALL_STORED;
+        return SMALL_HEADER_SIZE + n + TRAILER_SIZE;
+    }
+    *kind = SMALL_HUFFMAN;
+    return SMALL_HEADER_SIZE + *table_size + *coded_size + TRAILER_SIZE;
+}
+
+// Work out what small_encode() would come to for an input with this
+// histogram, without coding it.
+//
+// Input parameters:
+// hist: const uint64_t *: Count of each symbol, adding up to at most SMALL_MAX
+// kind: uint8_t *: Set to SMALL_STORED, SMALL_RUN or SMALL_HUFFMAN
+// table_size: uint32_t *: Set to the size of the code table
+// coded_size: uint32_t *: Set to the size of the coded data
+// Returns: uint32_t: Size of the small object
+uint32_t small_estimate(const uint64_t hist[static ALPHABET], uint8_t *kind, uint32_t *table_size, uint32_t *coded_size) {
+    uint32_t counts[ALPHABET];
+    uint8_t lengths[ALPHABET];
+    uint32_t n = 0;
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        counts[s] = (uint32_t) hist[s];
+        n += counts[s];
+    }
+    return plan(counts, n, lengths, kind, table_size, coded_size);
+}
+
+// Encode an input of up to SMALL_MAX bytes as a small object, in one go
+// and without allocating.
+//
+// Input parameters:
+// in: const uint8_t *: Bytes to encode
+// n: uint32_t: Number of bytes, at most SMALL_MAX
+// permissions: uint16_t: File mode to record
+// out: uint8_t []: Buffer of SMALL_MAX_SIZE bytes for the small object
+// Returns: uint32_t: Size of the small object
+uint32_t small_encode(const uint8_t *in, uint32_t n, uint16_t permissions, uint8_t out[static SMALL_MAX_SIZE]) {
+    uint32_t hist[ALPHABET] = { 0 };
+    uint8_t lengths[ALPHABET];
+    uint32_t codes[ALPHABET];
+    uint32_t next[SMALL_MAX_LENGTH + 2] = { 0 };
+    uint32_t pos = SMALL_HEADER_SIZE, table_size, coded_size, count = 0, code = 0, used = 0;
+    uint64_t acc = 0;
+    uint8_t kind;
+
+    for (uint32_t i = 0; i < n; i++) {
+        hist[in[i]] += 1;
+    }
+    plan(hist, n, lengths, &kind, &table_size, &coded_size);
+    store_le(out, MAGIC_SMALL, 4);
+    store_le(out + 4, permissions & HEADER_PERMISSIONS, 2);
+    store_le(out + 6, n, 2);
+    out[8] = kind;
+
+    if (kind == SMALL_STORED) {
+        memcpy(out + pos, in, n);
+        pos += n;
+    } else if (kind == SMALL_RUN) {
+        out[pos++] = in[0];
+    } else {
+        // The table, and canonical codes: shorter codes first, and codes
+        // of the same length in symbol order. next[len + 1] counts the
+        // codes of length len, till it is turned into the first of them.
+        memset(out + pos, 0, table_size);
+        for (uint32_t s = 0; s < ALPHABET; s++) {
+            if (lengths[s] != 0) {
+                out[pos + s / 8] |= (uint8_t) (1u << (s % 8));
+                out[pos + ALPHABET / 8 + used / 2] |= (uint8_t) (lengths[s] << (4 * (used % 2)));
+                next[lengths[s] + 1] += 1;
+                used += 1;
+            }
+        }
+        pos += table_size - 2;
+        store_le(out + pos, coded_size, 2);
+        pos += 2;
+        for (uint32_t len = 1; len <= SMALL_MAX_LENGTH; len++) {
+            code = (code + next[len]) << 1;
+            next[len] = code;
+        }
+        for (uint32_t s = 0; s < ALPHABET; s++) {
+            if (lengths[s] != 0) {
+                codes[s] = reverse_bits(next[lengths[s]]++, lengths[s]);
+            }
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            acc |= (uint64_t) codes[in[i]] << count;
+            count += lengths[in[i]];
+            if (count >= 32) {
+                store_le(out + pos, acc, 4);
+                pos += 4;
+                acc >>= 32;
+                count -= 32;
+            }
+        }
+        store_le(out + pos, acc, (count + 7) / 8);
+        pos += (count + 7) / 8;
+    }
+    store_le(out + pos, crc32c(0, in, n), TRAILER_SIZE);
+    return pos + TRAILER_SIZE;
+}
+
+// Read the rest of a small object whose header read_header() has read,
+// so that small_decode() can decode it. The header is laid out again at
+// the start of buf, and the rest is read after it, as far as its kind
+// and table say it goes, so nothing past the object is read.
+//
+// Input parameters:
+// ifd: int: File descriptor of the encoded file, positioned after the header
+// permissions: uint16_t: Permissions from the header
+// size: uint16_t: Size of the input from the header
+// buf: uint8_t []: Buffer of SMALL_MAX_SIZE bytes for the small object
+// Returns: uint32_t: Size of the small object, 0 if it is malformed or ends early
+uint32_t small_read(int ifd, uint16_t permissions, uint16_t size, uint8_t buf[static SMALL_MAX_SIZE]) {
+    uint32_t pos = SMALL_HEADER_SIZE, need, used = 0;
+
+    store_le(buf, MAGIC_SMALL, 4);
+    store_le(buf + 4, permissions, 2);
+    store_le(buf + 6, size, 2);
+    if (size > SMALL_MAX || read_bytes(ifd, buf + 8, 1) != 1) {
+        return 0;
+    }
+    if (buf[8] == SMALL_STORED) {
+        need = size;
+    } else if (buf[8] == SMALL_RUN) {
+        need = 1;
+    } else if (buf[8] == SMALL_HUFFMAN) {
+        if (read_bytes(ifd, buf + pos, ALPHABET / 8) != ALPHABET / 8) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < ALPHABET / 8; i++) {
+            used += (uint32_t) __builtin_popcount(buf[pos + i]);
+        }
+        pos += ALPHABET / 8;
+        need = (used + 1) / 2 + 2;
+        if (read_bytes(ifd, buf + pos, (int) need) != (int) need) {
+            return 0;
+        }
+        pos += need;
+        need = (uint32_t) load_le(buf + pos - 2, 2);
+        if (pos - SMALL_HEADER_SIZE + need >= size) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+    need += TRAILER_SIZE;
+    if (read_bytes(ifd, buf + pos, (int) need) != (int) need) {
+        return 0;
+    }
+    return pos + need;
+}
+
+// Decode canonical Huffman codes. Codes of up to SMALL_PEEK bits are
+// looked up by the next SMALL_PEEK bits; longer ones are decoded a bit at
+// a time, each length in turn having its codes checked, which start where
+// the codes of the lengths before it leave off.
+//
+// Input parameters:
+// count: const uint32_t *: Number of codes of each length
+// sorted: const uint8_t *: Symbols ordered by code length, then symbol
+// coded: const uint8_t *: Coded bits
+// coded_size: uint32_t: Number of coded bytes
+// out: uint8_t *: Where the symbols go
+// n: uint32_t: Number of symbols
+// Returns: bool: false if the bits run out or spell no code, or bytes are left over, true otherwise
+static bool decode_codes(const uint32_t count[static SMALL_MAX_LENGTH + 1], const uint8_t *sorted, const uint8_t *coded, uint32_t coded_size, uint8_t *out, uint32_t n) {
+    uint16_t peek[1 << SMALL_PEEK] = { 0 }; // Symbol, and its length above it.
+    uint64_t acc = 0;
+    uint32_t bits = 0, pos = 0, next = 0, sym = 0;
+
+    for (uint32_t len = 1; len <= SMALL_PEEK; len++) {
+        for (uint32_t j = 0; j < count[len]; j++, next++, sym++) {
+            for (uint32_t k = reverse_bits(next, len); k < (1 << SMALL_PEEK); k += 1 << len) {
+                peek[k] = (uint16_t) (sorted[sym] | len << 8);
+            }
+        }
+        next <<= 1;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t code = 0, first = 0, index = 0;
+        uint32_t len;
+
+        if (bits < SMALL_MAX_LENGTH) {
+            while (bits <= 56 && pos < coded_size) {
+                acc |= (uint64_t) coded[pos++] << bits;
+                bits += 8;
+            }
+        }
+        len = peek[acc & ((1 << SMALL_PEEK) - 1)] >> 8;
+        if (len != 0 && len <= bits) {
+            out[i] = (uint8_t) peek[acc & ((1 << SMALL_PEEK) - 1)];
+            acc >>= len;
+            bits -= len;
+            continue;
+        }
+        for (len = 1; len <= SMALL_MAX_LENGTH && len <= bits; len++) {
+            code |= (int32_t) (acc & 1);
+            acc >>= 1;
+            if (code - (int32_t) count[len] < first) {
+                out[i] = sorted[index + code - first];
+                break;
+            }
+            index += (int32_t) count[len];
+            first = (first + (int32_t) count[len]) << 1;
+            code <<= 1;
+        }
+        if (len > SMALL_MAX_LENGTH || len > bits) {
+            return false;
+        }
+        bits -= len;
+    }
+    return pos == coded_size && bits < 8;
+}
+
+// Decode a small object held in memory, without allocating. The CRC32C
+// it carries is handed back rather than checked, so that a caller that
+// checksums the output anyway need not do it twice.
+//
+// Input parameters:
+// in: const uint8_t *: The small object
+// size: uint32_t: Its size
+// out: uint8_t []: Buffer of SMALL_MAX bytes for the decoded bytes
+// n: uint32_t *: Set to the number of decoded bytes
+// checksum: uint32_t *: Set to the CRC32C that the decoded bytes should have
+// Returns: bool: false if the object is malformed, true otherwise
+bool small_decode(const uint8_t *in, uint32_t size, uint8_t out[static SMALL_MAX], uint32_t *n, uint32_t *checksum) {
+    uint32_t count[SMALL_MAX_LENGTH + 1] = { 0 };
+    uint32_t offset[SMALL_MAX_LENGTH + 2] = { 0 };
+    uint8_t lengths[ALPHABET], sorted[ALPHABET];
+    uint32_t pos = SMALL_HEADER_SIZE, used = 0, coded_size;
+    int32_t left = 1;
+
+    if (size < SMALL_HEADER_SIZE + TRAILER_SIZE || load_le(in, 4) != MAGIC_SMALL
+        || (*n = (uint32_t) load_le(in + 6, 2)) > SMALL_MAX) {
+        return false;
+    }
+    *checksum = (uint32_t) load_le(in + size - TRAILER_SIZE, TRAILER_SIZE);
+    size -= TRAILER_SIZE;
+    if (in[8] == SMALL_STORED && size == pos + *n) {
+        memcpy(out, in + pos, *n);
+        return true;
+    }
+    if (in[8] == SMALL_RUN && size == pos + 1 && *n != 0) {
+        memset(out, in[pos], *n);
+        return true;
+    }
+    if (in[8] != SMALL_HUFFMAN || size < pos + ALPHABET / 8) {
+        return false;
+    }
+
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        lengths[s] = 0;
+        if ((in[pos + s / 8] >> (s % 8) & 1) != 0) {
+            if (size < pos + ALPHABET / 8 + used / 2 + 1) {
+                return false;
+            }
+            lengths[s] = (in[pos + ALPHABET / 8 + used / 2] >> (4 * (used % 2))) & 0xf;
+            if (lengths[s] == 0) {
+                return false;
+            }
+            count[lengths[s]] += 1;
+            used += 1;
+        }
+    }
+    pos += ALPHABET / 8 + (used + 1) / 2;
+    if (used < 2 || size < pos + 2) {
+        return false;
+    }
+    coded_size = (uint32_t) load_le(in + pos, 2);
+    pos += 2;
+    if (size != pos + coded_size) {
+        return false;
+    }
+
+    // More codes of a length than the shorter ones leave room for cannot
+    // be a prefix code.
+    for (uint32_t len = 1; len <= SMALL_MAX_LENGTH; len++) {
+        left = 2 * left - (int32_t) count[len];
+        if (left < 0) {
+            return false;
+        }
+        offset[len + 1] = offset[len] + count[len];
+    }
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+        if (lengths[s] != 0) {
+            sorted[offset[lengths[s]]++] = (uint8_t) s;
+        }
+    }
+    return decode_codes(count, sorted, in + pos, coded_size, out, *n);
+}
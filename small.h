@@ -0,0 +1,38 @@
+#pragma once
+
+#include "defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SMALL_MAX         BLOCK // Largest input encoded as a small object.
+#define SMALL_MAX_LENGTH  15 // Longest code, so a length fits in 4 bits.
+#define SMALL_PEEK        8 // Codes up to this long decode with one lookup.
+#define SMALL_HEADER_SIZE 9 // Size of a small object's header.
+#define SMALL_TABLE_MAX   (ALPHABET / 8 + ALPHABET / 2 + 2) // Most bytes of a code table.
+#define SMALL_MAX_SIZE    (SMALL_HEADER_SIZE + SMALL_MAX + 4) // Largest small object.
+
+#define SMALL_STORED  0 // The bytes as is, and nothing at all for an empty input.
+#define SMALL_RUN     1 // A single byte, repeated size times.
+#define SMALL_HUFFMAN 2 // Canonical Huffman codes.
+
+// Inputs of up to SMALL_MAX bytes are encoded whole, as small objects,
+// in place of a version 2 file, whose header, block header and index
+// come to more than many such inputs do. A small object is laid out
+// little-endian as
+//
+//   u32 MAGIC_SMALL, u16 permissions, u16 size, u8 kind, body, u32 CRC32C
+//
+// where the body of SMALL_STORED is the size bytes, that of SMALL_RUN
+// the one byte, and that of SMALL_HUFFMAN a bitmap of the symbols that
+// occur, lowest symbol in the lowest bit, the 4-bit code length of each
+// of them, two to a byte, low half first, a u16 count of coded bytes,
+// and the codes. The codes are canonical, and written first bit lowest.
+// No tree is built either way, and nothing is allocated.
+
+uint32_t small_estimate(const uint64_t hist[static ALPHABET], uint8_t *kind, uint32_t *table_size, uint32_t *coded_size);
+
+uint32_t small_encode(const uint8_t *in, uint32_t n, uint16_t permissions, uint8_t out[static SMALL_MAX_SIZE]);
+
+uint32_t small_read(int ifd, uint16_t permissions, uint16_t size, uint8_t buf[static SMALL_MAX_SIZE]);
+
+bool small_decode(const uint8_t *in, uint32_t size, uint8_t out[static SMALL_MAX], uint32_t *n, uint32_t *checksum);
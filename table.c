@@ -0,0 +1,353 @@
+#include "table.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define MULTI_MIN_SYMBOLS (1 << 15) // Fewest symbols to build a two-symbol table for.
+#define MULTI_MIN_RATE    0.5 // Lowest share of lookups that must find two symbols.
+
+// A code and its length, gathered when building two-symbol entries.
+typedef struct {
+    uint16_t code;
+    uint8_t length;
+    uint8_t symbol;
+} Leaf;
+
+// Store both symbols of a two-symbol entry with a single 16-bit write.
+// The pair is kept in entry order, which is memory order on little
+// endian machines only.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define STORE_PAIR(out, e)                                                                         \
+    do {                                                                                           \
+        uint16_t pair = (uint16_t) ((e) >> 16);                                                    \
+        memcpy((out), &pair, 2);                                                                   \
+    } while (0)
+#else
+#define STORE_PAIR(out, e)                                                                         \
+    do {                                                                                           \
+        (out)[0] = (uint8_t) ((e) >> 16);                                                          \
+        (out)[1] = (uint8_t) ((e) >> 24);                                                          \
+    } while (0)
+#endif
+
+// Decode one symbol with a table that every code fits in. Only the
+// table width is a parameter, so each kernel gets its own constant mask.
+#define DECODE_SHORT(W)                                                                            \
+    do {                                                                                           \
+        uint16_t e = t->entries[r->bits & ((1u << (W)) - 1)];                                      \
+        *out++ = e >> 8;                                                                           \
+        r->bits >>= e & 0xff;                                                                      \
+        r->count -= e & 0xff;                                                                      \
+    } while (0)
+
+// Decode one symbol, walking the rest of the packed tree for codes
+// longer than the table. A node's children are next to each other, so
+// the next bit picks between them without a branch.
+#define DECODE_LONG(W)                                                                             \
+    do {                                                                                           \
+        uint16_t e = t->entries[r->bits & ((1u << (W)) - 1)];                                      \
+        if ((e & 0xff) != 0) {                                                                     \
+            *out++ = e >> 8;                                                                       \
+            r->bits >>= e & 0xff;                                                                  \
+            r->count -= e & 0xff;                                                                  \
+        } else {                                                                                   \
+            uint32_t node = t->subtrees[e >> 8];                                                   \
+            r->bits >>= (W);                                                                       \
+            r->count -= (W);                                                                       \
+            while ((node & PACKED_LEAF) == 0) {                                                    \
+                if (r->count == 0) {                                                               \
+                    bit_reader_refill(r);                                                          \
+                }                                                                                  \
+                node = t->tree[node + (r->bits & 1)];                                              \
+                r->bits >>= 1;                                                                     \
+                r->count -= 1;                                                                     \
+            }                                                                                      \
+            *out++ = (uint8_t) node;                                                               \
+        }                                                                                          \
+    } while (0)
+
+// Decode one or two symbols with a two-symbol entry. Both are always
+// stored, and out only moves past the second one if the entry has it.
+#define DECODE_PAIR(W)                                                                             \
+    do {                                                                                           \
+        uint32_t e = t->multi[r->bits & ((1u << (W)) - 1)];                                        \
+        uint32_t length = e & 0xff;                                                                \
+        STORE_PAIR(out, e);                                                                        \
+        out += 1 + (length != ((e >> 8) & 0xff));                                                  \
+        r->bits >>= length;                                                                        \
+        r->count -= length;                                                                        \
+    } while (0)
+
+// Decode only the first symbol of a two-symbol entry, for the last few
+// symbols of a run, where the second one may belong to the next run.
+#define DECODE_FIRST(W)                                                                            \
+    do {                                                                                           \
+        uint32_t e = t->multi[r->bits & ((1u << (W)) - 1)];                                        \
+        uint32_t length = (e >> 8) & 0xff;                                                         \
+        *out++ = (uint8_t) (e >> 16);                                                              \
+        r->bits >>= length;                                                                        \
+        r->count -= length;                                                                        \
+    } while (0)
+
+// Kernel for tables that hold every code. A refill leaves at least 57
+// bits, which covers four codes of up to 12 bits, so the loop refills
+// once per four symbols and has no other branches.
+#define SHORT_KERNEL(W)                                                                            \
+    static void decode_##W##_short(DecodeTable *t, BitReader *r, uint8_t *out, uint32_t n) {       \
+        uint8_t *end = out + n;                                                                    \
+        while (end - out >= 4) {                                                                   \
+            bit_reader_refill(r);                                                                  \
+            DECODE_SHORT(W);                                                                       \
+            DECODE_SHORT(W);                                                                       \
+            DECODE_SHORT(W);                                                                       \
+            DECODE_SHORT(W);                                                                       \
+        }                                                                                          \
+        while (out < end) {                                                                        \
+            bit_reader_refill(r);                                                                  \
+            DECODE_SHORT(W);                                                                       \
+        }                                                                                          \
+        return;                                                                                    \
+    }
+
+// Kernel for trees with codes longer than the table.
+#define LONG_KERNEL(W)                                                                             \
+    static void decode_##W##_long(DecodeTable *t, BitReader *r, uint8_t *out, uint32_t n) {        \
+        uint8_t *end = out + n;                                                                    \
+        while (out < end) {                                                                        \
+            bit_reader_refill(r);                                                                  \
+            DECODE_LONG(W);                                                                        \
+        }                                                                                          \
+        return;                                                                                    \
+    }
+
+// Kernel for two-symbol tables. Four lookups per refill produce up to
+// eight symbols, so the main loop stops while eight bytes of room remain.
+#define MULTI_KERNEL(W)                                                                            \
+    static void decode_##W##_multi(DecodeTable *t, BitReader *r, uint8_t *out, uint32_t n) {       \
+        uint8_t *end = out + n;                                                                    \
+        while (end - out >= 8) {                                                                   \
+            bit_reader_refill(r);                                                                  \
+            DECODE_PAIR(W);                                                                        \
+            DECODE_PAIR(W);                                                                        \
+            DECODE_PAIR(W);                                                                        \
+            DECODE_PAIR(W);                                                                        \
+        }                                                                                          \
+        while (out < end) {                                                                        \
+            bit_reader_refill(r);                                                                  \
+            DECODE_FIRST(W);                                                                       \
+        }                                                                                          \
+        return;                                                                                    \
+    }
+
+SHORT_KERNEL(8)
+SHORT_KERNEL(10)
+SHORT_KERNEL(11)
+SHORT_KERNEL(12)
+LONG_KERNEL(8)
+LONG_KERNEL(10)
+LONG_KERNEL(11)
+LONG_KERNEL(12)
+MULTI_KERNEL(11)
+MULTI_KERNEL(12)
+
+// Find the length of the longest code in the packed tree. Its nodes are
+// breadth first, so each node's children come after it and the last
+// node is a deepest leaf.
+//
+// Input parameters:
+// tree: const uint16_t *: Packed tree
+// Returns: uint32_t: Largest leaf depth
+static uint32_t max_depth(const uint16_t tree[static MAX_NODES]) {
+    uint8_t depth[MAX_NODES];
+    uint32_t end = 1;
+
+    depth[0] = 0;
+    for (uint32_t i = 0; i < end; i++) {
+        if ((tree[i] & PACKED_LEAF) == 0) {
+            depth[tree[i]] = depth[tree[i] + 1] = (uint8_t) (depth[i] + 1);
+            end = tree[i] + 2u;
+        }
+    }
+    return depth[end - 1];
+}
+
+// Fill in the entries for a subtree whose code so far is `prefix`, of
+// `depth` bits. Bits are consumed lowest first, so a leaf at depth d owns
+// every index whose low d bits equal its code.
+//
+// Input parameters:
+// t: DecodeTable *: Table being built
+// node: uint32_t: Root of the subtree, in t->tree
+// prefix: uint32_t: Code bits leading to node
+// depth: uint32_t: Number of bits in prefix
+// Returns: void
+static void fill_entries(DecodeTable *t, uint32_t node, uint32_t prefix, uint32_t depth) {
+    uint16_t entry = t->tree[node];
+
+    if (entry & PACKED_LEAF) {
+        uint16_t e = (uint16_t) (((entry & 0xff) << 8) | depth);
+        for (uint32_t i = prefix; i < (1u << t->bits); i += 1u << depth) {
+            t->entries[i] = e;
+        }
+    } else if (depth == t->bits) {
+        t->subtrees[t->num_subtrees] = entry;
+        t->entries[prefix] = (uint16_t) (t->num_subtrees << 8);
+        t->num_subtrees += 1;
+    } else {
+        fill_entries(t, entry, prefix, depth + 1);
+        fill_entries(t, entry + 1u, prefix | (1u << depth), depth + 1);
+    }
+    return;
+}
+
+// Gather the code and length of every leaf. Only called when all codes
+// fit in MAX_TABLE_BITS.
+//
+// Input parameters:
+// tree: const uint16_t *: Packed tree
+// node: uint32_t: Root of the subtree
+// prefix: uint32_t: Code bits leading to node
+// depth: uint32_t: Number of bits in prefix
+// leaves: Leaf *: Array of ALPHABET leaves to add to
+// num_leaves: uint32_t *: Number of leaves gathered so far
+// Returns: void
+static void collect_leaves(const uint16_t *tree, uint32_t node, uint32_t prefix, uint32_t depth,
+    Leaf *leaves, uint32_t *num_leaves) {
+    if (tree[node] & PACKED_LEAF) {
+        leaves[*num_leaves].code = (uint16_t) prefix;
+        leaves[*num_leaves].length = (uint8_t) depth;
+        leaves[*num_leaves].symbol = (uint8_t) tree[node];
+        *num_leaves += 1;
+    } else {
+        collect_leaves(tree, tree[node], prefix, depth + 1, leaves, num_leaves);
+        collect_leaves(tree, tree[node] + 1u, prefix | (1u << depth), depth + 1, leaves, num_leaves);
+    }
+    return;
+}
+
+// Estimate how often a lookup in a two-symbol table of width `bits`
+// yields two symbols. The coded bits of an optimal code look random, so
+// a code of length l starts a lookup with probability 2^-l, and a pair
+// fits when the two lengths add up to no more than the width.
+//
+// Input parameters:
+// leaves: Leaf *: Every leaf of the tree
+// num_leaves: uint32_t: Number of leaves
+// bits: uint32_t: Table width
+// Returns: double: Probability of decoding two symbols per lookup
+static double pair_rate(Leaf *leaves, uint32_t num_leaves, uint32_t bits) {
+    double count[MAX_TABLE_BITS + 1] = { 0 };
+    double rate = 0;
+
+    for (uint32_t i = 0; i < num_leaves; i++) {
+        count[leaves[i].length] += 1;
+    }
+    for (uint32_t a = 1; a < bits; a++) {
+        for (uint32_t b = 1; a + b <= bits; b++) {
+            rate += count[a] * count[b] / (double) (1u << (a + b));
+        }
+    }
+    return rate;
+}
+
+// Fill in the two-symbol entries. Each entry holds the total length in
+// its lowest byte, the first code's length in the next, then the first
+// and second symbols. Every index gets the first code it starts with,
+// and then every pair of codes that fits in the width overwrites the
+// indices it covers.
+//
+// Input parameters:
+// t: DecodeTable *: Table being built
+// leaves: Leaf *: Every leaf of the tree
+// num_leaves: uint32_t: Number of leaves
+// Returns: void
+static void fill_pairs(DecodeTable *t, Leaf *leaves, uint32_t num_leaves) {
+    for (uint32_t a = 0; a < num_leaves; a++) {
+        uint32_t la = leaves[a].length;
+        uint32_t e = la | (la << 8) | ((uint32_t) leaves[a].symbol << 16);
+        for (uint32_t i = leaves[a].code; i < (1u << t->bits); i += 1u << la) {
+            t->multi[i] = e;
+        }
+    }
+    for (uint32_t a = 0; a < num_leaves; a++) {
+        for (uint32_t b = 0; b < num_leaves; b++) {
+            uint32_t la = leaves[a].length;
+            uint32_t length = la + leaves[b].length;
+            uint32_t e;
+
+            if (length > t->bits) {
+                continue;
+            }
+            e = length | (la << 8) | ((uint32_t) leaves[a].symbol << 16)
+                | ((uint32_t) leaves[b].symbol << 24);
+            for (uint32_t i = leaves[a].code | ((uint32_t) leaves[b].code << la);
+                 i < (1u << t->bits); i += 1u << length) {
+                t->multi[i] = e;
+            }
+        }
+    }
+    return;
+}
+
+// Build the decode table for a tree, and pick the kernel to decode with.
+// When every code fits in 12 bits, the narrowest table that holds them
+// all is used, so the decode loop has no long-code branch. Otherwise the
+// table width grows with the number of symbols to decode, since a wider
+// table costs more to fill but resolves more codes in one lookup. The
+// tree must already be packed into t->tree, and its root must not be a
+// leaf.
+//
+// When the codes are short enough that most lookups would find two of
+// them, and there are enough symbols to pay for the bigger table, a
+// two-symbol table is used instead.
+//
+// Input parameters:
+// t: DecodeTable *: Table to build, holding the packed tree
+// nsymbols: uint64_t: Number of symbols that will be decoded
+// Returns: void
+void table_build(DecodeTable *t, uint64_t nsymbols) {
+    t->max_length = max_depth(t->tree);
+    t->num_subtrees = 0;
+
+    if (t->max_length <= MAX_TABLE_BITS && nsymbols >= MULTI_MIN_SYMBOLS) {
+        Leaf leaves[ALPHABET];
+        uint32_t num_leaves = 0;
+        uint32_t bits = t->max_length <= 11 && nsymbols < (1 << 20) ? 11 : 12;
+
+        collect_leaves(t->tree, 0, 0, 0, leaves, &num_leaves);
+        if (pair_rate(leaves, num_leaves, bits) >= MULTI_MIN_RATE) {
+            t->bits = bits;
+            t->decode = bits == 11 ? decode_11_multi : decode_12_multi;
+            fill_pairs(t, leaves, num_leaves);
+            return;
+        }
+    }
+
+    if (t->max_length <= 8) {
+        t->bits = 8;
+        t->decode = decode_8_short;
+    } else if (t->max_length <= 10) {
+        t->bits = 10;
+        t->decode = decode_10_short;
+    } else if (t->max_length <= 11) {
+        t->bits = 11;
+        t->decode = decode_11_short;
+    } else if (t->max_length <= 12) {
+        t->bits = 12;
+        t->decode = decode_12_short;
+    } else if (nsymbols >= (1 << 20)) {
+        t->bits = 12;
+        t->decode = decode_12_long;
+    } else if (nsymbols >= (1 << 16)) {
+        t->bits = 11;
+        t->decode = decode_11_long;
+    } else if (nsymbols >= (1 << 12)) {
+        t->bits = 10;
+        t->decode = decode_10_long;
+    } else {
+        t->bits = 8;
+        t->decode = decode_8_long;
+    }
+    fill_entries(t, 0, 0, 0);
+    return;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "defines.h"
+#include "huffman.h"
+#include "io.h"
+#include <stdint.h>
+
+#define MAX_TABLE_BITS 12 // Widest first-level decode table.
+
+typedef struct DecodeTable DecodeTable;
+
+// Each entry is indexed by the next `bits` coded bits, and holds the
+// symbol in its upper byte and the code length in its lower byte. Codes
+// longer than `bits` have a length of 0, and the upper byte then indexes
+// the subtree that the rest of the code is walked in, in `tree`, the
+// tree packed by pack_tree(). Two-symbol tables use `multi` instead,
+// whose entries decode up to two codes at once.
+struct DecodeTable {
+    uint16_t entries[1 << MAX_TABLE_BITS];
+    uint32_t multi[1 << MAX_TABLE_BITS];
+    uint16_t tree[MAX_NODES];
+    uint16_t subtrees[ALPHABET]; // Packed entry of each subtree's root.
+    uint32_t num_subtrees;
+    uint32_t bits;
+    uint32_t max_length;
+    void (*decode)(DecodeTable *t, BitReader *r, uint8_t *out, uint32_t n);
+};
+
+void table_build(DecodeTable *t, uint64_t nsymbols);
@@ -0,0 +1,392 @@
+#include "wide.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Decode table entries hold a symbol, or the offset of a second level
+// table, in their upper bits. The lowest byte holds the number of bits
+// the entry consumes, or WIDE_LINK plus the width of the second level.
+#define WIDE_LINK 0x80
+
+// A symbol and its count, sorted by count to build the code lengths.
+typedef struct {
+    uint64_t count;
+    uint16_t symbol;
+} WideLeaf;
+
+// Count the 16-bit symbols in buf. An odd byte at the end is not a
+// symbol, and is left to the caller.
+//
+// Input parameters:
+// wc: WideCoder *: Coder whose counts are updated
+// buf: uint8_t *: Input bytes
+// nbytes: int: Number of bytes in buf
+// Returns: void
+void wide_count(WideCoder *wc, uint8_t *buf, int nbytes) {
+    for (int i = 0; i + 1 < nbytes; i += 2) {
+        wc->counts[buf[i] | (buf[i + 1] << 8)] += 1;
+    }
+    return;
+}
+
+// Compare two leaves by count, then by symbol, for qsort().
+//
+// Input parameters:
+// a: const void *: First WideLeaf
+// b: const void *: Second WideLeaf
+// Returns: int: Negative, zero or positive as a sorts before, with or after b
+static int compare_leaves(const void *a, const void *b) {
+    const WideLeaf *x = (const WideLeaf *) a;
+    const WideLeaf *y = (const WideLeaf *) b;
+
+    if (x->count != y->count) {
+        return x->count < y->count ? -1 : 1;
+    }
+    return x->symbol - y->symbol;
+}
+
+// Compute Huffman code lengths for leaves sorted by increasing count.
+// Since the leaves are sorted, and the nodes made by joining two others
+// come out in increasing order too, the two smallest nodes are always at
+// the front of one of two queues. That makes the build linear after the
+// sort, instead of needing a priority queue.
+//
+// Input parameters:
+// leaves: WideLeaf *: Leaves sorted by count
+// n: uint32_t: Number of leaves, at least 2
+// lengths: uint8_t *: Set to the code length of each leaf, in the same order
+// Returns: uint32_t: Longest code length, or 0 if there is no memory to build with
+static uint32_t sorted_code_lengths(WideLeaf *leaves, uint32_t n, uint8_t *lengths) {
+    uint64_t *weight = (uint64_t *) calloc(n - 1, sizeof(uint64_t));
+    uint32_t *parent = (uint32_t *) calloc(2 * n - 1, sizeof(uint32_t));
+    uint32_t *depth = (uint32_t *) calloc(n - 1, sizeof(uint32_t));
+    uint32_t leaf = 0, node = 0, max = 0;
+
+    if (weight == NULL || parent == NULL || depth == NULL) {
+        free(weight);
+        free(parent);
+        free(depth);
+        return 0;
+    }
+
+    // Nodes 0 to n-1 in parent[] are leaves, and n onwards are joined
+    // nodes, in the order they are made.
+    for (uint32_t j = 0; j < n - 1; j++) {
+        for (int k = 0; k < 2; k++) {
+            uint32_t child;
+            if (leaf < n && (node == j || leaves[leaf].count <= weight[node])) {
+                child = leaf++;
+                weight[j] += leaves[child].count;
+            } else {
+                child = n + node++;
+                weight[j] += weight[child - n];
+            }
+            parent[child] = n + j;
+        }
+    }
+
+    // The root is the last node made, and every node's parent is made
+    // after it, so walking backwards sees parents first.
+    depth[n - 2] = 0;
+    for (uint32_t j = n - 2; j-- > 0;) {
+        depth[j] = depth[parent[n + j] - n] + 1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        lengths[i] = (uint8_t) (depth[parent[i] - n] + 1);
+        if (lengths[i] > max) {
+            max = lengths[i];
+        }
+    }
+    free(weight);
+    free(parent);
+    free(depth);
+    return max;
+}
+
+// Reverse the lowest n bits of code, since codes are built first bit
+// highest but written and looked up first bit lowest.
+//
+// Input parameters:
+// code: uint32_t: Code to reverse
+// n: uint32_t: Length of the code
+// Returns: uint32_t: Reversed code
+static uint32_t reverse_bits(uint32_t code, uint32_t n) {
+    uint32_t rev = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        rev = (rev << 1) | ((code >> i) & 1);
+    }
+    return rev;
+}
+
+// Assign canonical codes to a set of code lengths: shorter codes first,
+// and codes of the same length in symbol order. Only the lengths need
+// to be stored, since the decoder can assign the same codes.
+//
+// Input parameters:
+// used: uint16_t *: Symbols in increasing order
+// num_used: uint32_t: Number of symbols
+// lengths: uint8_t *: Code length of each symbol, indexed by symbol
+// codes: uint32_t *: Set to the reversed code of each symbol, indexed by symbol
+// Returns: void
+static void canonical_codes(uint16_t *used, uint32_t num_used, uint8_t *lengths, uint32_t *codes) {
+    uint32_t count[WIDE_MAX_LENGTH + 1] = { 0 };
+    uint32_t next[WIDE_MAX_LENGTH + 1] = { 0 };
+    uint32_t code = 0;
+
+    for (uint32_t i = 0; i < num_used; i++) {
+        count[lengths[used[i]]] += 1;
+    }
+    for (uint32_t len = 1; len <= WIDE_MAX_LENGTH; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (uint32_t i = 0; i < num_used; i++) {
+        uint32_t len = lengths[used[i]];
+        codes[used[i]] = reverse_bits(next[len]++, len);
+    }
+    return;
+}
+
+// Build the codes from the counts. Symbols that never occur get no code.
+// If the longest code is over WIDE_MAX_LENGTH, the counts are halved,
+// which flattens the tree, till it fits. A lone symbol gets a 1 bit code.
+//
+// Input parameters:
+// wc: WideCoder *: Coder whose counts are filled in
+// Returns: bool: false if there is no memory to build with, true otherwise
+bool wide_build(WideCoder *wc) {
+    WideLeaf *leaves;
+    uint8_t *lengths;
+    uint32_t n = 0, max;
+
+    for (uint32_t s = 0; s < WIDE_ALPHABET; s++) {
+        wc->lengths[s] = 0;
+        if (wc->counts[s] != 0) {
+            wc->used[n++] = (uint16_t) s;
+        }
+    }
+    wc->num_used = n;
+    if (n == 0) {
+        return true;
+    }
+    if (n == 1) {
+        wc->lengths[wc->used[0]] = 1;
+        canonical_codes(wc->used, n, wc->lengths, wc->codes);
+        return true;
+    }
+
+    leaves = (WideLeaf *) calloc(n, sizeof(WideLeaf));
+    lengths = (uint8_t *) calloc(n, sizeof(uint8_t));
+    if (leaves == NULL || lengths == NULL) {
+        free(leaves);
+        free(lengths);
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        leaves[i].symbol = wc->used[i];
+        leaves[i].count = wc->counts[wc->used[i]];
+    }
+    qsort(leaves, n, sizeof(WideLeaf), compare_leaves);
+
+    // Halving keeps the order of the counts, so there is no need to sort
+    // again.
+    while ((max = sorted_code_lengths(leaves, n, lengths)) > WIDE_MAX_LENGTH) {
+        for (uint32_t i = 0; i < n; i++) {
+            leaves[i].count = (leaves[i].count >> 1) | 1;
+        }
+    }
+    for (uint32_t i = 0; max != 0 && i < n; i++) {
+        wc->lengths[leaves[i].symbol] = lengths[i];
+    }
+    free(leaves);
+    free(lengths);
+    if (max != 0) {
+        canonical_codes(wc->used, n, wc->lengths, wc->codes);
+    }
+    return max != 0;
+}
+
+// Computes the exact number of bits that the coded symbols take up.
+//
+// Input parameters:
+// wc: WideCoder *: Coder with its codes built
+// Returns: uint64_t: Number of coded bits
+uint64_t wide_coded_bits(WideCoder *wc) {
+    uint64_t bits = 0;
+
+    for (uint32_t i = 0; i < wc->num_used; i++) {
+        bits += wc->counts[wc->used[i]] * wc->lengths[wc->used[i]];
+    }
+    return bits;
+}
+
+// Dump the code lengths of the used symbols into buf. Each symbol is
+// stored as the gap since the previous one, as a varint of 7 bits per
+// byte, followed by its code length in a byte. The varint takes up to 3
+// bytes, so buf must hold WIDE_ENTRY_SIZE bytes per used symbol.
+//
+// Input parameters:
+// wc: WideCoder *: Coder with its codes built
+// buf: uint8_t *: Buffer to dump the table into
+// Returns: uint32_t: Number of bytes dumped
+uint32_t wide_dump_table(WideCoder *wc, uint8_t *buf) {
+    uint32_t nbytes = 0;
+    uint32_t prev = 0;
+
+    for (uint32_t i = 0; i < wc->num_used; i++) {
+        uint32_t gap = wc->used[i] - prev;
+        while (gap >= 0x80) {
+            buf[nbytes++] = (uint8_t) (gap | 0x80);
+            gap >>= 7;
+        }
+        buf[nbytes++] = (uint8_t) gap;
+        buf[nbytes++] = wc->lengths[wc->used[i]];
+        prev = wc->used[i] + 1;
+    }
+    return nbytes;
+}
+
+// Write the codes for the 16-bit symbols in buf. As in wide_count(), an
+// odd byte at the end is left to the caller.
+//
+// Input parameters:
+// wc: WideCoder *: Coder with its codes built
+// w: BitWriter *: Writer to write the codes to
+// buf: uint8_t *: Input bytes
+// nbytes: int: Number of bytes in buf
+// Returns: void
+void wide_encode(WideCoder *wc, BitWriter *w, uint8_t *buf, int nbytes) {
+    for (int i = 0; i + 1 < nbytes; i += 2) {
+        uint32_t s = buf[i] | (buf[i + 1] << 8);
+        write_bits(w, wc->codes[s], wc->lengths[s]);
+    }
+    return;
+}
+
+// Rebuild the decode tables from a dumped table. The dump is checked as it
+// is parsed: symbols must be in range and in order, lengths must be
+// between 1 and WIDE_MAX_LENGTH, and the lengths must satisfy the Kraft
+// inequality, so that canonical codes can be assigned. Codes up to
+// WIDE_TABLE_BITS long are looked up in one step. Longer codes share a
+// first level entry per WIDE_TABLE_BITS prefix, which links to a second
+// level table as wide as the longest of them needs.
+//
+// Input parameters:
+// ws: WideWorkspace *: Workspace whose dump holds the dumped table
+// nbytes: uint32_t: Size of the dump
+// Returns: WideTable *: The decode table in ws, NULL if the dump is malformed
+WideTable *wide_table_build(WideWorkspace *ws, uint32_t nbytes) {
+    uint8_t *buf = ws->dump, *lengths = ws->lengths;
+    uint16_t *used = ws->used;
+    uint32_t *codes = ws->codes;
+    uint32_t sub_bits[1 << WIDE_TABLE_BITS] = { 0 };
+    uint32_t num_used = 0, max = 0, size, pos = 0, next = 0;
+    uint64_t kraft = 0;
+    WideTable *t = &ws->table;
+
+    if (nbytes > sizeof(ws->dump)) {
+        return NULL;
+    }
+    memset(lengths, 0, sizeof(ws->lengths));
+    while (pos < nbytes) {
+        uint32_t gap = 0, shift = 0, len;
+        while (pos < nbytes && (buf[pos] & 0x80) && shift < 21) {
+            gap |= (uint32_t) (buf[pos++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (pos + 2 > nbytes || shift >= 21) {
+            return NULL;
+        }
+        gap |= (uint32_t) buf[pos++] << shift;
+        len = buf[pos++];
+        if (next + gap >= WIDE_ALPHABET || len == 0 || len > WIDE_MAX_LENGTH) {
+            return NULL;
+        }
+        used[num_used++] = (uint16_t) (next + gap);
+        lengths[next + gap] = (uint8_t) len;
+        kraft += 1u << (WIDE_MAX_LENGTH - len);
+        max = len > max ? len : max;
+        next += gap + 1;
+    }
+    if (num_used == 0 || kraft > (1u << WIDE_MAX_LENGTH)) {
+        return NULL;
+    }
+    canonical_codes(used, num_used, lengths, codes);
+
+    // Size the second level tables first, so that they can be laid out
+    // one after the other behind the first level.
+    t->bits = max < WIDE_TABLE_BITS ? max : WIDE_TABLE_BITS;
+    t->entries = ws->entries;
+    size = 1u << t->bits;
+    for (uint32_t i = 0; i < num_used; i++) {
+        uint32_t len = lengths[used[i]];
+        uint32_t prefix = codes[used[i]] & (size - 1);
+        if (len > t->bits && len - t->bits > sub_bits[prefix]) {
+            sub_bits[prefix] = len - t->bits;
+        }
+    }
+    for (uint32_t p = 0; p < (1u << t->bits); p++) {
+        size += sub_bits[p] ? 1u << sub_bits[p] : 0;
+    }
+
+    // Entries no code reaches, which an incomplete code leaves, decode as
+    // symbol 0 and consume a bit. Corrupt input then makes progress, and
+    // is caught by the checksum.
+    for (uint32_t i = 0; i < size; i++) {
+        t->entries[i] = 1;
+    }
+    size = 1u << t->bits;
+    for (uint32_t p = 0; p < (1u << t->bits); p++) {
+        if (sub_bits[p] != 0) {
+            t->entries[p] = (size << 8) | WIDE_LINK | sub_bits[p];
+            size += 1u << sub_bits[p];
+        }
+    }
+    for (uint32_t i = 0; i < num_used; i++) {
+        uint32_t s = used[i], len = lengths[s], code = codes[s];
+        uint32_t base = 0, step_bits = len, fill_bits = t->bits;
+        if (len > t->bits) {
+            uint32_t link = t->entries[code & ((1u << t->bits) - 1)];
+            base = link >> 8;
+            code >>= t->bits;
+            step_bits = len - t->bits;
+            fill_bits = link & ~WIDE_LINK & 0xff;
+        }
+        for (uint32_t j = code; j < (1u << fill_bits); j += 1u << step_bits) {
+            t->entries[base + j] = (s << 8) | step_bits;
+        }
+    }
+    return t;
+}
+
+// Decode nsymbols 16-bit symbols into out, which must hold twice as many
+// bytes. Every code fits in the 57 bits a refill leaves, so each symbol
+// needs one refill and at most two lookups.
+//
+// Input parameters:
+// t: WideTable *: Decode table
+// r: BitReader *: Reader for the coded bits
+// out: uint8_t *: Decoded bytes, little-endian
+// nsymbols: uint32_t: Number of symbols to decode
+// Returns: void
+void wide_decode(WideTable *t, BitReader *r, uint8_t *out, uint32_t nsymbols) {
+    uint32_t mask = (1u << t->bits) - 1;
+
+    for (uint32_t i = 0; i < nsymbols; i++) {
+        uint32_t e;
+
+        bit_reader_refill(r);
+        e = t->entries[r->bits & mask];
+        if (e & WIDE_LINK) {
+            r->bits >>= t->bits;
+            r->count -= t->bits;
+            e = t->entries[(e >> 8) + (r->bits & ((1u << (e & ~WIDE_LINK & 0xff)) - 1))];
+        }
+        r->bits >>= e & 0xff;
+        r->count -= e & 0xff;
+        out[2 * i] = (uint8_t) (e >> 8);
+        out[2 * i + 1] = (uint8_t) (e >> 16);
+    }
+    return;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "io.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WIDE_ALPHABET   65536 // Every 16-bit symbol.
+#define WIDE_MAX_LENGTH 20 // Longest code, so two table levels cover it.
+#define WIDE_TABLE_BITS 11 // Width of the first decode table level.
+#define WIDE_ENTRY_SIZE 4 // Most bytes a symbol takes in a dumped table.
+
+// Most entries a decode table can have: the first level, and a second
+// level as wide as the longest code allows under every prefix.
+#define WIDE_MAX_ENTRIES                                                                           \
+    ((1u << WIDE_TABLE_BITS) + (1u << WIDE_TABLE_BITS) * (1u << (WIDE_MAX_LENGTH - WIDE_TABLE_BITS)))
+
+// Counts and codes for coding the input as 16-bit little-endian symbols.
+// The counts are kept dense, since that is the fastest way to gather
+// them, but everything after that works on the list of used symbols.
+typedef struct {
+    uint64_t counts[WIDE_ALPHABET];
+    uint32_t codes[WIDE_ALPHABET];
+    uint8_t lengths[WIDE_ALPHABET];
+    uint16_t used[WIDE_ALPHABET];
+    uint32_t num_used;
+} WideCoder;
+
+typedef struct {
+    uint32_t bits;
+    uint32_t *entries;
+} WideTable;
+
+// Room to rebuild a decode table from its dump, sized for the largest
+// table any dump can give, so that nothing is allocated per block. The
+// dump is read into dump, and the table built from it is left in table.
+typedef struct {
+    uint8_t dump[WIDE_ALPHABET * WIDE_ENTRY_SIZE];
+    uint8_t lengths[WIDE_ALPHABET];
+    uint16_t used[WIDE_ALPHABET];
+    uint32_t codes[WIDE_ALPHABET];
+    uint32_t entries[WIDE_MAX_ENTRIES];
+    WideTable table;
+} WideWorkspace;
+
+void wide_count(WideCoder *wc, uint8_t *buf, int nbytes);
+
+bool wide_build(WideCoder *wc);
+
+uint64_t wide_coded_bits(WideCoder *wc);
+
+uint32_t wide_dump_table(WideCoder *wc, uint8_t *buf);
+
+void wide_encode(WideCoder *wc, BitWriter *w, uint8_t *buf, int nbytes);
+
+WideTable *wide_table_build(WideWorkspace *ws, uint32_t nbytes);
+
+void wide_decode(WideTable *t, BitReader *r, uint8_t *out, uint32_t nsymbols);